@@ -0,0 +1,116 @@
+/*
+ * affinity.c
+ *
+ * Thread placement of the hybrid MPI+OpenMP build
+ *
+ * The intended layout is one rank per NUMA domain (e.g. mpirun
+ * --map-by numa --bind-to numa) with one thread per core of the domain.
+ * Unless the OpenMP runtime is told where to place the threads
+ * (OMP_PROC_BIND / OMP_PLACES), every thread is pinned to one CPU of the
+ * mask the rank was started with, spread evenly over the mask.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "heat.h"
+
+#define AFFINITY_LINE 256
+
+/*
+ * Pin the OpenMP threads of this rank, returns 1 if the threads were
+ * pinned here and 0 if the placement is left to the runtime
+ */
+int bind_threads(void)
+{
+#ifdef _OPENMP
+	cpu_set_t mask;
+	int cpus[CPU_SETSIZE];
+	int ncpus = 0, c;
+
+	if (getenv("OMP_PROC_BIND") || getenv("OMP_PLACES"))
+		return 0;
+	if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+		return 0;
+
+	for (c = 0; c < CPU_SETSIZE; c++)
+		if (CPU_ISSET(c, &mask))
+			cpus[ncpus++] = c;
+	if (ncpus == 0)
+		return 0;
+
+#pragma omp parallel
+	{
+		const int t = omp_get_thread_num();
+		const int nt = omp_get_num_threads();
+		cpu_set_t one;
+
+		CPU_ZERO(&one);
+		CPU_SET(nt <= ncpus ? cpus[t * ncpus / nt] : cpus[t % ncpus], &one);
+		sched_setaffinity(0, sizeof(one), &one);
+	}
+
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/*
+ * Print host, process grid position, and the CPU of every thread of
+ * every rank on rank 0
+ */
+void report_affinity(algoparam_t *param, int pinned)
+{
+	char line[AFFINITY_LINE], host[64];
+	char *all = 0;
+	int len, r;
+
+	gethostname(host, sizeof(host));
+	host[sizeof(host) - 1] = '\0';
+
+	len = snprintf(line, sizeof(line), "  rank %3d (%d,%d) on %s:", param->rank,
+				   param->coords[0], param->coords[1], host);
+
+#ifdef _OPENMP
+	{
+		const int nt = omp_get_max_threads();
+		int cpu[nt];
+		int t;
+
+#pragma omp parallel
+		cpu[omp_get_thread_num()] = sched_getcpu();
+
+		len += snprintf(line + len, sizeof(line) - len, " %d thread(s), cpu", nt);
+		for (t = 0; t < nt && len < (int)sizeof(line); t++)
+			len += snprintf(line + len, sizeof(line) - len, " %d", cpu[t]);
+	}
+#else
+	len += snprintf(line + len, sizeof(line) - len, " cpu %d", sched_getcpu());
+#endif
+
+	if (param->rank == 0)
+		all = (char *)malloc((size_t)AFFINITY_LINE * param->size);
+
+	MPI_Gather(line, AFFINITY_LINE, MPI_CHAR, all, AFFINITY_LINE, MPI_CHAR, 0, param->comm);
+
+	if (param->rank == 0)
+	{
+#ifdef _OPENMP
+		fprintf(stderr, "Thread placement  : %s\n", pinned ? "pinned to the rank's cpu mask" : "OMP_PROC_BIND / OMP_PLACES");
+#else
+		fprintf(stderr, "Thread placement  : MPI only\n");
+#endif
+		for (r = 0; r < param->size; r++)
+			fprintf(stderr, "%.*s\n", AFFINITY_LINE, &all[r * AFFINITY_LINE]);
+		free(all);
+	}
+}
@@ -0,0 +1,130 @@
+/*
+ * arena.c
+ *
+ * Persistent memory of the two solution grids
+ *
+ * u and uhelp are carved out of one block that is sized once for the
+ * largest local grid of the resolution sweep and reused by every
+ * experiment, so the sweep does not map and fault in fresh pages for
+ * every resolution. The grids start on cache line boundaries. The second
+ * grid is staggered by an odd number of cache lines, so u[k] and uhelp[k]
+ * never share a 4 KiB page offset: the loads of u and the stores to
+ * uhelp at the same index do not alias in the load/store disambiguation.
+ *
+ * The rows of a grid are padded to the leading dimension ld (param->ld):
+ * a whole number of cache lines, so every row starts on a cache line,
+ * plus one more line if the row would be a multiple of 4 KiB. Otherwise
+ * rows i-1, i and i+1, which the stencil reads together, map to the same
+ * cache sets whenever the row length is a power of two. The padding
+ * points are never read.
+ *
+ * Optionally the block is backed by huge pages: transparent huge pages
+ * with madvise(MADV_HUGEPAGE), or explicit ones (MAP_HUGETLB) from the
+ * pool reserved in /proc/sys/vm/nr_hugepages, falling back to
+ * transparent huge pages if the pool is too small.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "heat.h"
+
+#define ARENA_ALIGN 64                  // cache line
+#define ARENA_STAGGER (5 * ARENA_ALIGN) // offset of uhelp within a page
+#define ARENA_PAGE 4096
+#define ARENA_HUGE_PAGE (2UL << 20)
+
+const char *arena_page_names[] = {"4 KiB", "transparent huge", "explicit huge"};
+
+static size_t round_up(size_t n, size_t a)
+{
+	return (n + a - 1) / a * a;
+}
+
+/*
+ * Leading dimension of a grid with rows of sizex points
+ */
+int arena_stride(int sizex)
+{
+	const int line = ARENA_ALIGN / sizeof(double);
+	int ld = (int)round_up(sizex, line);
+
+	if ((ld * sizeof(double)) % ARENA_PAGE == 0)
+		ld += line;
+
+	return ld;
+}
+
+/*
+ * Allocate the arena for the largest local grid up to max_res,
+ * returns 1 on success
+ */
+int arena_setup(algoparam_t *param)
+{
+	const unsigned res = param->max_res > param->initial_res ? param->max_res : param->initial_res;
+	int start, rows, cols;
+	size_t grid, bytes;
+	char *base = MAP_FAILED;
+	int pages = param->huge_pages;
+	long i, j, sizex, sizey, ld;
+	int k;
+
+	decompose(res, param->dims[0], param->coords[0], &start, &rows);
+	decompose(res, param->dims[1], param->coords[1], &start, &cols);
+	sizex = cols + 2 * param->halo;
+	sizey = rows + 2 * param->halo;
+	ld = arena_stride(sizex); // no smaller resolution has a longer stride
+
+	grid = round_up(sizeof(double) * ld * sizey, ARENA_PAGE);
+	bytes = 2 * grid + ARENA_STAGGER;
+
+	if (pages == 2)
+	{
+		bytes = round_up(bytes, ARENA_HUGE_PAGE);
+		base = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (base == MAP_FAILED)
+			pages = 1;
+	}
+	if (base == MAP_FAILED)
+	{
+		if (pages == 1)
+			bytes = round_up(bytes, ARENA_HUGE_PAGE);
+		base = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED)
+			return 0;
+		if (pages == 1 && madvise(base, bytes, MADV_HUGEPAGE) != 0)
+			pages = 0;
+	}
+
+	param->arena.base = base;
+	param->arena.bytes = bytes;
+	param->arena.pages = pages;
+	param->arena.grid[0] = (double *)base;
+	param->arena.grid[1] = (double *)(base + grid + ARENA_STAGGER);
+
+	// fault in each grid once, with the row schedule of the sweeps at the
+	// largest resolution, so a thread's rows of u and uhelp are local to it
+	for (k = 0; k < 2; k++)
+	{
+		double *g = param->arena.grid[k];
+
+#pragma omp parallel for private(j) schedule(static)
+		for (i = 0; i < sizey; i++)
+			for (j = 0; j < sizex; j++)
+				g[i * ld + j] = 0.0;
+	}
+
+	return 1;
+}
+
+void arena_free(algoparam_t *param)
+{
+	if (param->arena.base)
+	{
+		munmap(param->arena.base, param->arena.bytes);
+		param->arena.base = 0;
+		param->arena.grid[0] = param->arena.grid[1] = 0;
+	}
+}
@@ -0,0 +1,234 @@
+/*
+ * bench.c
+ *
+ * Benchmark harness: statistics of repeated trials
+ *
+ * Every resolution is solved bench_warmup times untimed and bench_trials
+ * times timed (see heat.c). A sample holds the solve time of the trial,
+ * its compute sweep and the phases of timing.h, each the maximum over the
+ * processes, so a sample is the time of the slowest process. The summary
+ * (min, median, mean, standard deviation and the samples themselves) is
+ * written with the configuration of the run as JSON, or as CSV with one
+ * row per resolution if the file name ends in .csv.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "heat.h"
+#include "input.h"
+
+const char *bench_field_names[BENCH_FIELDS] = {"total", "compute", "halo", "reduce", "gather"};
+static const char *precisions[] = {"double", "float", "mixed"};
+
+void bench_init(bench_t *bench, int trials)
+{
+	memset(bench, 0, sizeof(bench_t));
+	bench->trials = trials;
+}
+
+/*
+ * Record the trials x BENCH_FIELDS samples of a resolution
+ */
+int bench_add(bench_t *bench, unsigned res, unsigned iter, double flop, const double *samples)
+{
+	const int n = bench->nres + 1;
+	const size_t len = (size_t)bench->trials * BENCH_FIELDS;
+	unsigned *r, *it;
+	double *f, *s;
+
+	r = (unsigned *)realloc(bench->res, sizeof(unsigned) * n);
+	if (r)
+		bench->res = r;
+	it = (unsigned *)realloc(bench->iter, sizeof(unsigned) * n);
+	if (it)
+		bench->iter = it;
+	f = (double *)realloc(bench->flop, sizeof(double) * n);
+	if (f)
+		bench->flop = f;
+	s = (double *)realloc(bench->samples, sizeof(double) * n * len);
+	if (s)
+		bench->samples = s;
+	if (!r || !it || !f || !s)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
+
+	bench->res[bench->nres] = res;
+	bench->iter[bench->nres] = iter;
+	bench->flop[bench->nres] = flop;
+	memcpy(bench->samples + bench->nres * len, samples, sizeof(double) * len);
+	bench->nres = n;
+
+	return 1;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Statistics of x[0], x[stride], ... x[(n - 1) * stride],
+ * sample standard deviation (0 for a single value)
+ */
+void bench_stats(const double *x, int n, int stride, double *min, double *median, double *mean, double *stddev)
+{
+	double sorted[n], sum = 0.0, sq = 0.0;
+	int i;
+
+	for (i = 0; i < n; i++)
+	{
+		sorted[i] = x[i * stride];
+		sum += sorted[i];
+	}
+	qsort(sorted, n, sizeof(double), compare_double);
+
+	*mean = sum / n;
+	for (i = 0; i < n; i++)
+		sq += (sorted[i] - *mean) * (sorted[i] - *mean);
+
+	*min = sorted[0];
+	*median = n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+	*stddev = n > 1 ? sqrt(sq / (n - 1)) : 0.0;
+}
+
+static int num_threads(void)
+{
+#ifdef _OPENMP
+	return omp_get_max_threads();
+#else
+	return 1;
+#endif
+}
+
+static void write_json(FILE *f, bench_t *bench, algoparam_t *param, const char *host, const char *date)
+{
+	const int len = bench->trials * BENCH_FIELDS;
+	struct timespec ts;
+	double min, median, mean, stddev;
+	int r, k, t;
+
+	clock_getres(CLOCK_MONOTONIC, &ts);
+
+	fprintf(f, "{\n  \"config\": {\n");
+	fprintf(f, "    \"host\": \"%s\",\n    \"date\": \"%s\",\n", host, date);
+	fprintf(f, "    \"ranks\": %d,\n    \"process_grid\": [%d, %d],\n    \"threads\": %d,\n",
+			param->size, param->dims[0], param->dims[1], num_threads());
+	fprintf(f, "    \"algorithm\": \"%s\",\n    \"simd\": \"%s\",\n    \"precision\": \"%s\",\n",
+			algorithm_names[param->algorithm], simd_names[param->simd], precisions[param->precision]);
+	fprintf(f, "    \"halo_depth\": %d,\n    \"overlap\": %d,\n    \"check_every\": %d,\n    \"check_lag\": %d,\n",
+			param->halo, param->overlap, param->check_every, param->check_lag);
+	fprintf(f, "    \"nested\": %d,\n    \"maxiter\": %u,\n", param->nested, param->maxiter);
+	fprintf(f, "    \"trials\": %d,\n    \"warmup\": %d,\n", bench->trials, param->bench_warmup);
+	fprintf(f, "    \"timer\": \"clock_gettime(CLOCK_MONOTONIC)\",\n    \"timer_resolution\": %g,\n",
+			ts.tv_sec + 1e-9 * ts.tv_nsec);
+	fprintf(f, "    \"reduction\": \"max over processes\"\n  },\n  \"results\": [");
+
+	for (r = 0; r < bench->nres; r++)
+	{
+		const double *s = bench->samples + r * len;
+
+		fprintf(f, "%s\n    {\n      \"resolution\": %u,\n      \"iterations\": %u,\n      \"flop\": %.6e,\n",
+				r ? "," : "", bench->res[r], bench->iter[r], bench->flop[r]);
+
+		bench_stats(s, bench->trials, BENCH_FIELDS, &min, &median, &mean, &stddev);
+		fprintf(f, "      \"mflops\": %.3f,\n", bench->flop[r] / median / 1000000);
+
+		for (k = 0; k < BENCH_FIELDS; k++)
+		{
+			bench_stats(s + k, bench->trials, BENCH_FIELDS, &min, &median, &mean, &stddev);
+			fprintf(f, "      \"%s\": {\"min\": %.9f, \"median\": %.9f, \"mean\": %.9f, \"stddev\": %.9f, \"samples\": [",
+					bench_field_names[k], min, median, mean, stddev);
+			for (t = 0; t < bench->trials; t++)
+				fprintf(f, "%s%.9f", t ? ", " : "", s[t * BENCH_FIELDS + k]);
+			fprintf(f, "]}%s\n", k < BENCH_FIELDS - 1 ? "," : "");
+		}
+		fprintf(f, "    }");
+	}
+	fprintf(f, "\n  ]\n}\n");
+}
+
+static void write_csv(FILE *f, bench_t *bench, algoparam_t *param, const char *host, const char *date)
+{
+	const int len = bench->trials * BENCH_FIELDS;
+	double min, median, mean, stddev;
+	int r, k;
+
+	fprintf(f, "host,date,ranks,prows,pcols,threads,algorithm,trials,warmup,resolution,iterations,flop,mflops");
+	for (k = 0; k < BENCH_FIELDS; k++)
+		fprintf(f, ",%s_min,%s_median,%s_mean,%s_stddev",
+				bench_field_names[k], bench_field_names[k], bench_field_names[k], bench_field_names[k]);
+	fprintf(f, "\n");
+
+	for (r = 0; r < bench->nres; r++)
+	{
+		const double *s = bench->samples + r * len;
+
+		bench_stats(s, bench->trials, BENCH_FIELDS, &min, &median, &mean, &stddev);
+		fprintf(f, "%s,%s,%d,%d,%d,%d,%s,%d,%d,%u,%u,%.6e,%.3f",
+				host, date, param->size, param->dims[0], param->dims[1], num_threads(),
+				algorithm_names[param->algorithm], bench->trials, param->bench_warmup,
+				bench->res[r], bench->iter[r], bench->flop[r], bench->flop[r] / median / 1000000);
+		for (k = 0; k < BENCH_FIELDS; k++)
+		{
+			bench_stats(s + k, bench->trials, BENCH_FIELDS, &min, &median, &mean, &stddev);
+			fprintf(f, ",%.9f,%.9f,%.9f,%.9f", min, median, mean, stddev);
+		}
+		fprintf(f, "\n");
+	}
+}
+
+/*
+ * Write the summary of all resolutions (rank 0), returns 1 on success
+ */
+int bench_write(bench_t *bench, algoparam_t *param, const char *filename)
+{
+	const size_t n = strlen(filename);
+	char host[256], date[32];
+	time_t now = time(0);
+	FILE *f;
+	int ok;
+
+	if (!(f = fopen(filename, "w")))
+	{
+		fprintf(stderr, "Error: Cannot open \"%s\" for writing\n", filename);
+		return 0;
+	}
+
+	if (gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "unknown");
+	host[sizeof(host) - 1] = 0;
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	if (n > 4 && strcmp(filename + n - 4, ".csv") == 0)
+		write_csv(f, bench, param, host, date);
+	else
+		write_json(f, bench, param, host, date);
+
+	ok = !ferror(f);
+	ok = (fclose(f) == 0) && ok;
+	if (!ok)
+		fprintf(stderr, "Error: Cannot write \"%s\"\n", filename);
+
+	return ok;
+}
+
+void bench_free(bench_t *bench)
+{
+	free(bench->res);
+	free(bench->iter);
+	free(bench->flop);
+	free(bench->samples);
+	memset(bench, 0, sizeof(bench_t));
+}
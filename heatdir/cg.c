@@ -0,0 +1,364 @@
+/*
+ * cg.c
+ *
+ * Preconditioned Conjugate Gradient solver
+ *
+ * Solves the 5-point Laplace problem  4u - sum(neighbors) = 0  on the
+ * distributed blocks of initialize(), the boundary values of u enter
+ * through the initial residual. All work vectors have a single ghost layer
+ * that is exchanged with exchange_halo() before applying the operator;
+ * their ghost cells at the physical boundary stay zero.
+ *
+ * Two variants:
+ * - standard PCG with two reductions per iteration
+ * - pipelined PCG (Ghysels & Vanroose) with a single MPI_Iallreduce per
+ *   iteration that is overlapped with the preconditioner and the
+ *   operator application (including its halo exchange)
+ *
+ * Preconditioners: none, Jacobi (diagonal) or SSOR. SSOR is applied
+ * block-locally on every rank (block Jacobi with SSOR blocks), which
+ * keeps it symmetric and free of communication.
+ */
+
+#include "heat.h"
+#include <mpi.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "timing.h"
+
+// work vectors of the solver, the pipelined variant uses all of them
+enum
+{
+	CG_R, // residual
+	CG_U, // preconditioned residual
+	CG_P, // search direction
+	CG_Q, // A p, resp. M^-1 s in the pipelined variant
+	CG_W, // A u
+	CG_M, // M^-1 w
+	CG_N, // A m
+	CG_Z, // A q
+	CG_S, // A p
+	CG_NVEC
+};
+
+int cg_setup(algoparam_t *param)
+{
+	const int size = param->ld * (param->local_rows + 2);
+	int v;
+
+	param->cg.vec[0] = (double *)calloc(sizeof(double), (size_t)size * CG_NVEC);
+	if (!param->cg.vec[0])
+		return 0;
+	for (v = 1; v < CG_NVEC; v++)
+		param->cg.vec[v] = param->cg.vec[0] + (size_t)v * size;
+
+	param->cg.started = 0;
+	param->cg.omega = 2.0 / (1.0 + sin(M_PI / (param->act_res + 1)));
+
+	return 1;
+}
+
+void cg_free(algoparam_t *param)
+{
+	if (param->cg.vec[0])
+	{
+		free(param->cg.vec[0]);
+		param->cg.vec[0] = 0;
+	}
+}
+
+/*
+ * q = A p, p gets its halo exchanged
+ */
+static void apply_operator(double *p, double *q, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	const unsigned ld = param->ld;
+	int i, j;
+
+	exchange_halo(p, sizex, sizey, param);
+
+#pragma omp parallel for private(j)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		for (j = 1; j < sizex - 1; j++)
+		{
+			q[i * ld + j] = 4.0 * p[i * ld + j] -
+							(p[i * ld + (j - 1)] + p[i * ld + (j + 1)] +
+							 p[(i - 1) * ld + j] + p[(i + 1) * ld + j]);
+		}
+	}
+}
+
+/*
+ * z = M^-1 r
+ */
+static void apply_preconditioner(double *r, double *z, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	const double omega = param->cg.omega;
+	const unsigned ld = param->ld;
+	int i, j;
+
+	switch (param->cg_precond)
+	{
+	case 0: // none
+		memcpy(z, r, sizeof(double) * ld * sizey);
+		break;
+
+	case 1: // Jacobi
+#pragma omp parallel for private(j)
+		for (i = 1; i < sizey - 1; i++)
+			for (j = 1; j < sizex - 1; j++)
+				z[i * ld + j] = 0.25 * r[i * ld + j];
+		break;
+
+	case 2: // SSOR on the local block, ghost cells of z are not used
+		// forward sweep: (D - omega L) y = omega (2 - omega) r
+		for (i = 1; i < sizey - 1; i++)
+			for (j = 1; j < sizex - 1; j++)
+				z[i * ld + j] = 0.25 * (omega * (2.0 - omega) * r[i * ld + j] +
+										omega * ((i > 1 ? z[(i - 1) * ld + j] : 0.0) +
+												 (j > 1 ? z[i * ld + (j - 1)] : 0.0)));
+
+		// backward sweep: (D - omega U) z = D y
+		for (i = sizey - 2; i >= 1; i--)
+			for (j = sizex - 2; j >= 1; j--)
+				z[i * ld + j] += 0.25 * omega * ((i < sizey - 2 ? z[(i + 1) * ld + j] : 0.0) +
+												 (j < sizex - 2 ? z[i * ld + (j + 1)] : 0.0));
+		break;
+	}
+}
+
+/*
+ * Local dot product over the interior
+ */
+static double dot(double *a, double *b, unsigned ld, unsigned sizex, unsigned sizey)
+{
+	int i, j;
+	double sum = 0.0;
+
+#pragma omp parallel for private(j) reduction(+ : sum)
+	for (i = 1; i < sizey - 1; i++)
+		for (j = 1; j < sizex - 1; j++)
+			sum += a[i * ld + j] * b[i * ld + j];
+
+	return sum;
+}
+
+/*
+ * r = b - A u for the current solution including its boundary values
+ */
+static void initial_residual(double *u, double *r, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	const unsigned ld = param->ld;
+	int i, j;
+
+	exchange_halo(u, sizex, sizey, param);
+
+	for (i = 1; i < sizey - 1; i++)
+		for (j = 1; j < sizex - 1; j++)
+			r[i * ld + j] = u[i * ld + (j - 1)] + u[i * ld + (j + 1)] +
+							u[(i - 1) * ld + j] + u[(i + 1) * ld + j] -
+							4.0 * u[i * ld + j];
+}
+
+/*
+ * One iteration of standard PCG
+ *
+ * Returns the global (r, r) after the update
+ */
+static double pcg(double *u, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	double *r = param->cg.vec[CG_R], *z = param->cg.vec[CG_U];
+	double *p = param->cg.vec[CG_P], *q = param->cg.vec[CG_Q];
+	const unsigned ld = param->ld;
+	double local[2], global[2], alpha, beta, t0;
+	int i, j;
+
+	if (!param->cg.started)
+	{
+		initial_residual(u, r, sizex, sizey, param);
+		apply_preconditioner(r, z, sizex, sizey, param);
+		memcpy(p, z, sizeof(double) * ld * sizey);
+
+		local[0] = dot(r, z, ld, sizex, sizey);
+		t0 = wtime();
+		MPI_Allreduce(local, &param->cg.rho, 1, MPI_DOUBLE, MPI_SUM, param->comm);
+		phase_add(PHASE_REDUCE, t0);
+		param->cg.started = 1;
+	}
+
+	apply_operator(p, q, sizex, sizey, param);
+
+	local[0] = dot(p, q, ld, sizex, sizey);
+	t0 = wtime();
+	MPI_Allreduce(local, global, 1, MPI_DOUBLE, MPI_SUM, param->comm);
+	phase_add(PHASE_REDUCE, t0);
+	alpha = param->cg.rho / global[0];
+
+#pragma omp parallel for private(j)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		for (j = 1; j < sizex - 1; j++)
+		{
+			u[i * ld + j] += alpha * p[i * ld + j];
+			r[i * ld + j] -= alpha * q[i * ld + j];
+		}
+	}
+
+	apply_preconditioner(r, z, sizex, sizey, param);
+
+	// rho and the convergence check share one reduction
+	local[0] = dot(r, z, ld, sizex, sizey);
+	local[1] = dot(r, r, ld, sizex, sizey);
+	t0 = wtime();
+	MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, param->comm);
+	phase_add(PHASE_REDUCE, t0);
+
+	beta = global[0] / param->cg.rho;
+	param->cg.rho = global[0];
+
+#pragma omp parallel for private(j)
+	for (i = 1; i < sizey - 1; i++)
+		for (j = 1; j < sizex - 1; j++)
+			p[i * ld + j] = z[i * ld + j] + beta * p[i * ld + j];
+
+	return global[1];
+}
+
+/*
+ * One iteration of pipelined PCG (Ghysels & Vanroose, Algorithm 4)
+ *
+ * All dot products are merged into a single MPI_Iallreduce that is
+ * completed after the preconditioner and the operator application,
+ * the additional vectors carry the recurrences for A u, M^-1 w, ...
+ * in exchange.
+ *
+ * Returns the global (r, r) before the update
+ */
+static double pipelined_pcg(double *x, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	double *r = param->cg.vec[CG_R], *u = param->cg.vec[CG_U];
+	double *p = param->cg.vec[CG_P], *q = param->cg.vec[CG_Q];
+	double *w = param->cg.vec[CG_W], *m = param->cg.vec[CG_M];
+	double *n = param->cg.vec[CG_N], *z = param->cg.vec[CG_Z];
+	double *s = param->cg.vec[CG_S];
+	const unsigned ld = param->ld;
+	double local[3], global[3], alpha, beta, gamma, delta, t0;
+	MPI_Request req;
+	int i, j;
+
+	if (!param->cg.started)
+	{
+		initial_residual(x, r, sizex, sizey, param);
+		apply_preconditioner(r, u, sizex, sizey, param);
+		apply_operator(u, w, sizex, sizey, param);
+	}
+
+	// gamma = (r, u), delta = (w, u) and (r, r) in one nonblocking reduction
+	local[0] = dot(r, u, ld, sizex, sizey);
+	local[1] = dot(w, u, ld, sizex, sizey);
+	local[2] = dot(r, r, ld, sizex, sizey);
+	t0 = wtime();
+	MPI_Iallreduce(local, global, 3, MPI_DOUBLE, MPI_SUM, param->comm, &req);
+	phase_add(PHASE_REDUCE, t0);
+
+	// overlapped with the reduction
+	apply_preconditioner(w, m, sizex, sizey, param);
+	apply_operator(m, n, sizex, sizey, param);
+
+	t0 = wtime();
+	MPI_Wait(&req, MPI_STATUS_IGNORE);
+	phase_add(PHASE_REDUCE, t0);
+	gamma = global[0];
+	delta = global[1];
+
+	if (!param->cg.started)
+	{
+		beta = 0.0;
+		alpha = gamma / delta;
+		param->cg.started = 1;
+	}
+	else
+	{
+		beta = gamma / param->cg.rho;
+		alpha = gamma / (delta - beta * gamma / param->cg.alpha);
+	}
+	param->cg.rho = gamma;
+	param->cg.alpha = alpha;
+
+#pragma omp parallel for private(j)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		for (j = 1; j < sizex - 1; j++)
+		{
+			const int k = i * ld + j;
+
+			z[k] = n[k] + beta * z[k];
+			q[k] = m[k] + beta * q[k];
+			s[k] = w[k] + beta * s[k];
+			p[k] = u[k] + beta * p[k];
+
+			x[k] += alpha * p[k];
+			r[k] -= alpha * s[k];
+			u[k] -= alpha * q[k];
+			w[k] -= alpha * z[k];
+		}
+	}
+
+	return global[2];
+}
+
+/*
+ * One CG iteration on param->u
+ *
+ * Returns the global squared residual scaled like the Jacobi update
+ * (r / 4), i.e. comparable with the other solvers. No further reduction
+ * is needed by the caller.
+ */
+double relax_cg(algoparam_t *param)
+{
+	const unsigned sizex = param->local_cols + 2;
+	const unsigned sizey = param->local_rows + 2;
+	double rr;
+
+	if (param->cg_pipelined)
+		rr = pipelined_pcg(param->u, sizex, sizey, param);
+	else
+		rr = pcg(param->u, sizex, sizey, param);
+
+	return rr / 16.0;
+}
+
+/*
+ * Approximate flop count of one CG iteration per grid point
+ */
+double flops_cg(algoparam_t *param)
+{
+	static const double precond[] = {0.0, 1.0, 12.0};
+
+	// operator 5, dot products 2 each, vector updates 2 each
+	if (param->cg_pipelined)
+		return 5.0 + 3 * 2.0 + 8 * 2.0 + precond[param->cg_precond];
+
+	return 5.0 + 3 * 2.0 + 3 * 2.0 + precond[param->cg_precond];
+}
+
+/*
+ * Approximate main memory traffic of one CG iteration per grid point:
+ * 8 bytes per vector read or written, 8 more for the write-allocate of
+ * a vector that is written without being read
+ */
+double bytes_cg(algoparam_t *param)
+{
+	static const double precond[] = {24.0, 24.0, 40.0};
+
+	// dot products 40, operator 24, 8 vector updates 24 each
+	if (param->cg_pipelined)
+		return 40.0 + 24.0 + 8 * 24.0 + precond[param->cg_precond];
+
+	// operator 24, dot products 40, u and r update 48, p update 24
+	return 24.0 + 40.0 + 48.0 + 24.0 + precond[param->cg_precond];
+}
@@ -0,0 +1,285 @@
+/*
+ * checkpoint.c
+ *
+ * Checkpoint/restart of the solver state with MPI-IO
+ *
+ * A checkpoint holds a small header (resolution, algorithm, iteration,
+ * SOR factor) followed by the global (act_res + 2)^2 grid in row-major
+ * order, so it does not depend on the process grid and can be restarted
+ * with any number of processes. Every process copies the points it owns
+ * into a buffer, and a helper thread writes its rows into the file with
+ * pwrite() while the sweeps go on. The helper does not call MPI, so the
+ * write progresses without MPI calls and with MPI_THREAD_FUNNELED
+ * (nonblocking collective MPI-IO is only progressed inside MPI calls by
+ * common implementations). The write is completed at the next checkpoint
+ * or at the end of the resolution, then the file replaces the previous
+ * checkpoint, so an interrupted write never destroys the latest one.
+ * A restart reads the grid with collective MPI-IO through a subarray view.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "heat.h"
+
+#define CKPT_MAGIC "HEATCKP1"
+#define CKPT_HEADER 64 // bytes reserved for the header
+
+typedef struct
+{
+	char magic[8];
+	int act_res;
+	int algorithm;
+	unsigned iter;
+	int pad;
+	double omega;
+} ckpt_header_t;
+
+// write of the helper thread
+struct ckptjob
+{
+	pthread_t thread;
+	int fd;
+	double *buf;            // owned points, rows x cols
+	int rows, cols;
+	off_t offset, stride;   // file offset of the first row, row distance in bytes
+	int err;
+	int threaded;           // 1=>written by the helper thread
+	char tmpname[1024];
+};
+
+/*
+ * Subarray of the owned points of this process in the global grid
+ */
+static MPI_Datatype owned_type(algoparam_t *param, int *count)
+{
+	int sizes[2], subsizes[2], starts[2];
+	int lo_y, hi_y, lo_x, hi_x;
+	MPI_Datatype type;
+
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
+
+	sizes[0] = sizes[1] = param->act_res + 2;
+	subsizes[0] = hi_y - lo_y;
+	subsizes[1] = hi_x - lo_x;
+	starts[0] = lo_y;
+	starts[1] = lo_x;
+	MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, &type);
+	MPI_Type_commit(&type);
+
+	*count = subsizes[0] * subsizes[1];
+	return type;
+}
+
+/*
+ * Helper thread: write the owned rows and flush them to the disk
+ */
+static void *write_rows(void *arg)
+{
+	ckptjob_t *job = (ckptjob_t *)arg;
+	size_t len = sizeof(double) * job->cols, done;
+	ssize_t n;
+	int i;
+
+	for (i = 0; i < job->rows && !job->err; i++)
+	{
+		const char *row = (const char *)(job->buf + (size_t)i * job->cols);
+
+		for (done = 0; done < len; done += n)
+		{
+			n = pwrite(job->fd, row + done, len - done, job->offset + i * job->stride + done);
+			if (n <= 0)
+			{
+				job->err = 1;
+				break;
+			}
+		}
+	}
+
+	if (fsync(job->fd) != 0)
+		job->err = 1;
+
+	return 0;
+}
+
+/*
+ * Start writing a checkpoint of iteration iter, completes the previous one
+ */
+int checkpoint_begin(algoparam_t *param, unsigned iter)
+{
+	const off_t np = param->act_res + 2;
+	ckptjob_t *job;
+	ckpt_header_t h;
+	int lo_y, hi_y, lo_x, hi_x, ok = 1;
+
+	checkpoint_end(param);
+
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
+
+	job = (ckptjob_t *)calloc(1, sizeof(ckptjob_t));
+	if (job)
+		job->buf = (double *)malloc(sizeof(double) * (hi_y - lo_y) * (hi_x - lo_x));
+	if (!job || !job->buf)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		free(job);
+		return 0;
+	}
+	job->rows = hi_y - lo_y;
+	job->cols = hi_x - lo_x;
+	job->stride = sizeof(double) * np;
+	job->offset = CKPT_HEADER + sizeof(double) * (lo_y * np + lo_x);
+	copy_owned(param, job->buf, 0);
+
+	// rank 0 creates the file with its final size and the header
+	snprintf(job->tmpname, sizeof(job->tmpname), "%s.tmp", param->ckpt_file);
+	if (param->rank == 0)
+	{
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, CKPT_MAGIC, sizeof(h.magic));
+		h.act_res = param->act_res;
+		h.algorithm = param->algorithm;
+		h.iter = iter;
+		h.omega = param->omega;
+
+		job->fd = open(job->tmpname, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+		ok = job->fd >= 0 &&
+			 ftruncate(job->fd, CKPT_HEADER + sizeof(double) * np * np) == 0 &&
+			 pwrite(job->fd, &h, sizeof(h), 0) == sizeof(h);
+	}
+	MPI_Bcast(&ok, 1, MPI_INT, 0, param->comm);
+	if (!ok)
+	{
+		if (param->rank == 0)
+		{
+			fprintf(stderr, "Error: Cannot write \"%s\"\n", job->tmpname);
+			if (job->fd >= 0)
+				close(job->fd);
+		}
+		free(job->buf);
+		free(job);
+		return 0;
+	}
+
+	if (param->rank != 0)
+		job->fd = open(job->tmpname, O_WRONLY);
+	if (job->fd < 0)
+		job->err = 1;
+	else if (pthread_create(&job->thread, 0, write_rows, job) == 0)
+		job->threaded = 1;
+	else
+		write_rows(job); // no thread, write synchronously
+
+	param->ckpt.job = job;
+	param->ckpt.active = 1;
+
+	return 1;
+}
+
+/*
+ * Complete the checkpoint in flight and make it the latest one
+ */
+void checkpoint_end(algoparam_t *param)
+{
+	ckptjob_t *job = param->ckpt.job;
+	int err;
+
+	if (!param->ckpt.active)
+		return;
+
+	if (job->threaded)
+		pthread_join(job->thread, 0);
+	if (job->fd >= 0)
+		close(job->fd);
+
+	// all data is in the file before it replaces the previous checkpoint
+	MPI_Allreduce(&job->err, &err, 1, MPI_INT, MPI_MAX, param->comm);
+	if (param->rank == 0)
+	{
+		if (err)
+			fprintf(stderr, "Warning: Checkpoint \"%s\" not written\n", job->tmpname);
+		else if (rename(job->tmpname, param->ckpt_file) != 0)
+			fprintf(stderr, "Warning: Cannot rename \"%s\"\n", job->tmpname);
+	}
+
+	free(job->buf);
+	free(job);
+	param->ckpt.job = 0;
+	param->ckpt.active = 0;
+}
+
+/*
+ * Read the header of the checkpoint, sets act_res and returns the
+ * iteration to resume from in iter
+ */
+int checkpoint_probe(algoparam_t *param, unsigned *iter)
+{
+	ckpt_header_t h;
+	MPI_File fh;
+
+	if (MPI_File_open(param->comm, param->ckpt_file, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS)
+	{
+		if (param->rank == 0)
+			fprintf(stderr, "Error: Cannot open checkpoint \"%s\"\n", param->ckpt_file);
+		return 0;
+	}
+	MPI_File_read_at_all(fh, 0, &h, sizeof(h), MPI_BYTE, MPI_STATUS_IGNORE);
+	MPI_File_close(&fh);
+
+	if (memcmp(h.magic, CKPT_MAGIC, sizeof(h.magic)) != 0 || h.algorithm != param->algorithm ||
+		h.act_res < (int)param->initial_res || h.act_res > (int)param->max_res)
+	{
+		if (param->rank == 0)
+			fprintf(stderr, "Error: Checkpoint \"%s\" does not match the input\n", param->ckpt_file);
+		return 0;
+	}
+
+	param->act_res = h.act_res;
+	param->ckpt.omega = h.omega;
+	*iter = h.iter;
+
+	return 1;
+}
+
+/*
+ * Load the grid and the SOR factor of the checkpoint after initialize()
+ */
+int checkpoint_load(algoparam_t *param)
+{
+	MPI_Datatype filetype;
+	MPI_File fh;
+	double *buf;
+	int count, err;
+
+	filetype = owned_type(param, &count);
+	buf = (double *)malloc(sizeof(double) * count);
+	if (!buf)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		MPI_Type_free(&filetype);
+		return 0;
+	}
+
+	err = MPI_File_open(param->comm, param->ckpt_file, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh);
+	if (err == MPI_SUCCESS)
+	{
+		MPI_File_set_view(fh, CKPT_HEADER, MPI_DOUBLE, filetype, "native", MPI_INFO_NULL);
+		err = MPI_File_read_all(fh, buf, count, MPI_DOUBLE, MPI_STATUS_IGNORE);
+		MPI_File_close(&fh);
+	}
+
+	if (err == MPI_SUCCESS)
+	{
+		copy_owned(param, buf, 1);
+		param->omega = param->ckpt.omega;
+	}
+
+	MPI_Type_free(&filetype);
+	free(buf);
+
+	return err == MPI_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/*
+ * energy.c
+ *
+ * Energy to solution from the RAPL counters of Linux powercap
+ *
+ * The energy counters of the packages and of their DRAM subdomains
+ * (/sys/class/powercap/intel-rapl:<package>[:<sub>]/energy_uj, also used
+ * for AMD processors) cover a whole node, so only the first process of
+ * every node reads them and the energy of the nodes is summed. The
+ * platform domain (psys) contains the packages and is left out, the core
+ * and uncore subdomains are part of their package. The counters wrap
+ * around at max_energy_range_uj.
+ *
+ * The counters are often readable by root only. Energy is reported only
+ * if every node has readable counters, otherwise the run goes on without.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "heat.h"
+
+#ifndef ENERGY_SYSFS
+#define ENERGY_SYSFS "/sys/class/powercap"
+#endif
+
+/*
+ * First number in the file, -1 if it cannot be read
+ */
+static double read_number(int fd)
+{
+	char buf[32];
+	ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+
+	if (n <= 0)
+		return -1.0;
+	buf[n] = 0;
+
+	return atof(buf);
+}
+
+/*
+ * Open the counter of domain dir (relative to ENERGY_SYSFS) if it counts,
+ * returns 1 if added
+ */
+static int add_domain(energy_t *energy, const char *dir)
+{
+	char path[512], name[32] = "";
+	FILE *f;
+	int fd, sub = strchr(strchr(dir, ':') + 1, ':') != 0;
+
+	if (energy->n == ENERGY_DOMAINS)
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/%s/name", ENERGY_SYSFS, dir);
+	if (!(f = fopen(path, "r")))
+		return 0;
+	if (fscanf(f, "%31s", name) != 1)
+		name[0] = 0;
+	fclose(f);
+
+	// packages and their DRAM
+	if (strcmp(name, "psys") == 0 || (sub && strcmp(name, "dram") != 0))
+		return 0;
+
+	snprintf(path, sizeof(path), "%s/%s/max_energy_range_uj", ENERGY_SYSFS, dir);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	energy->range[energy->n] = read_number(fd);
+	close(fd);
+
+	snprintf(path, sizeof(path), "%s/%s/energy_uj", ENERGY_SYSFS, dir);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+	if (read_number(fd) < 0.0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	energy->fd[energy->n++] = fd;
+	return 1;
+}
+
+/*
+ * Find the counters of this node (collective), returns 1 if the energy
+ * of all nodes can be measured
+ */
+int energy_open(energy_t *energy, algoparam_t *param)
+{
+	MPI_Comm node;
+	struct dirent *d;
+	DIR *dir;
+	int node_rank, ok[2];
+
+	memset(energy, 0, sizeof(energy_t));
+
+	MPI_Comm_split_type(param->comm, MPI_COMM_TYPE_SHARED, param->rank, MPI_INFO_NULL, &node);
+	MPI_Comm_rank(node, &node_rank);
+	MPI_Comm_free(&node);
+
+	if (node_rank == 0 && (dir = opendir(ENERGY_SYSFS)))
+	{
+		while ((d = readdir(dir)))
+			if (strncmp(d->d_name, "intel-rapl:", 11) == 0)
+				add_domain(energy, d->d_name);
+		closedir(dir);
+	}
+
+	// nodes, nodes with counters
+	ok[0] = node_rank == 0;
+	ok[1] = node_rank == 0 && energy->n > 0;
+	MPI_Allreduce(MPI_IN_PLACE, ok, 2, MPI_INT, MPI_SUM, param->comm);
+	energy->nodes = ok[0];
+
+	if (ok[1] < ok[0])
+	{
+		energy_close(energy);
+		energy->nodes = 0;
+		return 0;
+	}
+
+	return 1;
+}
+
+void energy_close(energy_t *energy)
+{
+	int i;
+
+	for (i = 0; i < energy->n; i++)
+		close(energy->fd[i]);
+	energy->n = 0;
+}
+
+void energy_begin(energy_t *energy)
+{
+	int i;
+
+	for (i = 0; i < energy->n; i++)
+		energy->start[i] = read_number(energy->fd[i]);
+}
+
+/*
+ * Energy since energy_begin() of all nodes in joules, on rank 0
+ * (collective), -1 if not measured
+ */
+double energy_end(energy_t *energy, algoparam_t *param)
+{
+	double uj, sum = 0.0, joules = -1.0;
+	int i;
+
+	if (!energy->nodes)
+		return -1.0;
+
+	for (i = 0; i < energy->n; i++)
+	{
+		uj = read_number(energy->fd[i]) - energy->start[i];
+		if (uj < 0.0)
+			uj += energy->range[i];
+		sum += uj;
+	}
+
+	MPI_Reduce(&sum, &joules, 1, MPI_DOUBLE, MPI_SUM, 0, param->comm);
+
+	return joules * 1e-6;
+}
@@ -0,0 +1,104 @@
+/*
+ * halo.c
+ *
+ * Ghost cell exchange between neighboring blocks
+ * of the 2D Cartesian decomposition
+ *
+ */
+
+#include "heat.h"
+#include <mpi.h>
+
+#include "timing.h"
+
+/*
+ * Exchange the halo of the local block u (sizex x sizey elements of es
+ * bytes including param->halo ghost layers on each side, rows param->ld
+ * elements apart) with all four neighbors, column describes the interior
+ * columns of one side.
+ *
+ * Columns are strided and sent with the derived column type first,
+ * then the rows are sent over the full width including the ghost columns,
+ * which also fills the corners needed by deep halos.
+ * Missing neighbors are MPI_PROC_NULL, so the calls turn into no-ops
+ * at the physical boundary.
+ */
+static void exchange(char *u, size_t es, MPI_Datatype type, MPI_Datatype column,
+					 unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	const int h = param->halo;
+	const int ld = param->ld;
+	const int rows = (h - 1) * ld + sizex; // h rows, without the padding of the last
+	const double t0 = wtime();
+
+	// Send first columns left, receive right ghost columns from the right
+	MPI_Sendrecv(&u[es * (h * ld + h)], 1, column, param->left_neighbor, 2,
+				 &u[es * (h * ld + (sizex - h))], 1, column, param->right_neighbor, 2,
+				 param->comm, MPI_STATUS_IGNORE);
+
+	// Send last columns right, receive left ghost columns from the left
+	MPI_Sendrecv(&u[es * (h * ld + (sizex - 2 * h))], 1, column, param->right_neighbor, 3,
+				 &u[es * (h * ld + 0)], 1, column, param->left_neighbor, 3,
+				 param->comm, MPI_STATUS_IGNORE);
+
+	// Send first rows up, receive bottom ghost rows from below
+	MPI_Sendrecv(&u[es * (h * ld)], rows, type, param->top_neighbor, 0,
+				 &u[es * ((sizey - h) * ld)], rows, type, param->bottom_neighbor, 0,
+				 param->comm, MPI_STATUS_IGNORE);
+
+	// Send last rows down, receive top ghost rows from above
+	MPI_Sendrecv(&u[es * ((sizey - 2 * h) * ld)], rows, type, param->bottom_neighbor, 1,
+				 &u[0], rows, type, param->top_neighbor, 1,
+				 param->comm, MPI_STATUS_IGNORE);
+
+	phase_add(PHASE_HALO, t0);
+}
+
+void exchange_halo(double *u, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	exchange((char *)u, sizeof(double), MPI_DOUBLE, param->column_t, sizex, sizey, param);
+}
+
+/*
+ * Same for the float grids of the mixed-precision mode
+ */
+void exchange_halo_float(float *u, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	exchange((char *)u, sizeof(float), MPI_FLOAT, param->column_float_t, sizex, sizey, param);
+}
+
+/*
+ * Start a nonblocking halo exchange of a single ghost layer, the ghost
+ * cells of u are valid after exchange_halo_end(). The interior of u must
+ * not be modified in between.
+ */
+void exchange_halo_begin(double *u, unsigned sizex, unsigned sizey, algoparam_t *param, MPI_Request req[8])
+{
+	const int cols = sizex - 2;
+	const int ld = param->ld;
+	const double t0 = wtime();
+
+	// post receives first so that the messages can be delivered directly
+	MPI_Irecv(&u[0 * ld + 1], cols, MPI_DOUBLE, param->top_neighbor, 1, param->comm, &req[0]);
+	MPI_Irecv(&u[(sizey - 1) * ld + 1], cols, MPI_DOUBLE, param->bottom_neighbor, 0, param->comm, &req[1]);
+	MPI_Irecv(&u[1 * ld + 0], 1, param->column_t, param->left_neighbor, 3, param->comm, &req[2]);
+	MPI_Irecv(&u[1 * ld + (sizex - 1)], 1, param->column_t, param->right_neighbor, 2, param->comm, &req[3]);
+
+	MPI_Isend(&u[1 * ld + 1], cols, MPI_DOUBLE, param->top_neighbor, 0, param->comm, &req[4]);
+	MPI_Isend(&u[(sizey - 2) * ld + 1], cols, MPI_DOUBLE, param->bottom_neighbor, 1, param->comm, &req[5]);
+	MPI_Isend(&u[1 * ld + 1], 1, param->column_t, param->left_neighbor, 2, param->comm, &req[6]);
+	MPI_Isend(&u[1 * ld + (sizex - 2)], 1, param->column_t, param->right_neighbor, 3, param->comm, &req[7]);
+
+	phase_add(PHASE_HALO, t0);
+}
+
+/*
+ * Complete a halo exchange started with exchange_halo_begin()
+ */
+void exchange_halo_end(MPI_Request req[8])
+{
+	const double t0 = wtime();
+
+	MPI_Waitall(8, req, MPI_STATUSES_IGNORE);
+	phase_add(PHASE_HALO, t0);
+}
@@ -10,39 +10,86 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
 #include "input.h"
 #include "timing.h"
 
 void usage(char *s)
 {
-	fprintf(stderr, "Usage: %s <input file> [result file]\n\n", s);
+	fprintf(stderr, "Usage: %s [options] <input file> [result file] [P Q]\n\n", s);
+	fprintf(stderr, "  result file            binary PPM image, or float PFM field if it ends in .pfm\n");
+	fprintf(stderr, "  P Q                    process grid with P rows and Q columns (0 = chosen by MPI)\n");
+	fprintf(stderr, "  -o, --overlap          overlap the halo exchange with the interior update (Jacobi)\n");
+	fprintf(stderr, "  -c, --check-every=K    reduce the residual only every K iterations\n");
+	fprintf(stderr, "  -l, --check-lag=L      nonblocking residual reduction, tested L iterations later\n");
+	fprintf(stderr, "  -d, --halo-depth=K     K ghost layers, exchanged every K sweeps (Jacobi)\n");
+	fprintf(stderr, "  -t, --tile=W           sweep Jacobi in column strips of W points (0 = whole rows)\n");
+	fprintf(stderr, "  -b, --gs-block=W       pipeline Gauss-Seidel in blocks of W columns (0 = whole rows)\n");
+	fprintf(stderr, "  -s, --smoother=S       multigrid smoother: redblack (default) or jacobi\n");
+	fprintf(stderr, "  -w, --omega=W          SOR factor of Gauss-Seidel and Red-Black: a value, opt or adapt\n");
+	fprintf(stderr, "  -f, --precision=P      Jacobi grids: double (default), float, or mixed (float, refined in double)\n");
+	fprintf(stderr, "  -v, --simd=S           stencil kernels: auto (default), scalar, avx2 or avx512\n");
+	fprintf(stderr, "  -n, --nt-stores        non-temporal stores of the Jacobi target grid (vector kernels)\n");
+	fprintf(stderr, "  -N, --nested           start every resolution from the interpolated previous solution\n");
+	fprintf(stderr, "  -C, --checkpoint=FILE  checkpoint file (MPI-IO, independent of the process grid)\n");
+	fprintf(stderr, "  -K, --checkpoint-every=N  write a checkpoint every N iterations\n");
+	fprintf(stderr, "  -r, --restart          resume from the checkpoint file\n");
+	fprintf(stderr, "  -D, --dump=FILE        write the full resolution field with MPI-IO (float PFM)\n");
+	fprintf(stderr, "  -H, --huge-pages=M     grid arena pages: none (default), thp or hugetlb\n");
+	fprintf(stderr, "  -p, --precond=M        CG preconditioner: none, jacobi (default) or ssor\n");
+	fprintf(stderr, "  -P, --pipelined        pipelined CG with a single nonblocking reduction per iteration\n");
+	fprintf(stderr, "  -T, --trials=N         time N runs of every resolution (min, median, stddev)\n");
+	fprintf(stderr, "  -W, --warmup=N         untimed runs of every resolution before the trials\n");
+	fprintf(stderr, "  -B, --bench=FILE       phase timings of the trials as JSON, or CSV if FILE ends in .csv\n");
+	fprintf(stderr, "  -e, --counters         hardware counters of the solve and its kernels (perf_event_open)\n");
+	fprintf(stderr, "  -R, --trace=FILE       timeline of the phases of all processes (Chrome trace JSON)\n");
+	fprintf(stderr, "  -E, --trace-events=N   trace ring buffer of N events per process (default 65536)\n");
+	fprintf(stderr, "  -S, --roofline         measure the memory bandwidth (STREAM triad), report the share of it\n");
+	fprintf(stderr, "  -J, --energy           energy to solution from the RAPL counters (powercap)\n\n");
 }
 
 int main(int argc, char *argv[])
 {
 	int rank, size;
-	unsigned iter;
+	unsigned iter, iter0, check_iter, extra, resume;
+	int trial;
 	FILE *infile, *resfile;
-	char *resfilename;
+	char *resfilename = "heat.ppm";
 
 	// algorithmic parameters
 	algoparam_t param;
-	int np, i;
+	int np, ny, i, arg, nargs;
+	int provided, pinned;
+	unsigned visx, visy;
+	gather_t gather;
+	bench_t bench;
+	perf_t perf;
+	roofline_t roof;
+	energy_t energy;
 
 	double runtime, flop;
 	double residual, global_residual;
+	double local_residual, reduced_residual;
+	double redundant;
+	double t0, sample[BENCH_FIELDS], *samples;
+	double joules = -1.0;
+	double tmin, tmedian, tmean, tstddev;
+	MPI_Request check_req;
 	double time[1000];
 	double floprate[1000];
 	int resolution[1000];
 	int experiment = 0;
 
-	MPI_Init(&argc, &argv);
+	// only the master thread of the hybrid build calls MPI
+	MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
 	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
 	MPI_Comm_size(MPI_COMM_WORLD, &size);
 
 	// check arguments
-	if (argc < 2)
+	arg = read_options(argc, argv, &param);
+	nargs = argc - arg;
+	if (arg < 0 || nargs < 1 || nargs > 4)
 	{
 		if (rank == 0)
 			usage(argv[0]);
@@ -50,18 +97,41 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	// optional process grid: <input file> [result file] [P Q]
+	param.dims[0] = param.dims[1] = 0;
+	if (nargs >= 3)
+	{
+		param.dims[0] = atoi(argv[argc - 2]);
+		param.dims[1] = atoi(argv[argc - 1]);
+	}
+	if (nargs == 2 || nargs == 4)
+		resfilename = argv[arg + 1];
+
+	// set up the 2D Cartesian topology, ranks may be reordered
+	if (!create_topology(&param))
+	{
+		if (rank == 0)
+			usage(argv[0]);
+		MPI_Finalize();
+		return 1;
+	}
+	rank = param.rank;
+	size = param.size;
+
+	// pin the threads before any data is touched
+	pinned = bind_threads();
+
 	// check input file
-	if (!(infile = fopen(argv[1], "r")))
+	if (!(infile = fopen(argv[arg], "r")))
 	{
-		fprintf(stderr, "\nRank %d: Error: Cannot open \"%s\" for reading.\n\n", rank, argv[1]);
+		fprintf(stderr, "\nRank %d: Error: Cannot open \"%s\" for reading.\n\n", rank, argv[arg]);
 		MPI_Abort(MPI_COMM_WORLD, 1);
 	}
 
 	// check result file
 	if (rank == 0)
 	{
-		resfilename = (argc >= 3) ? argv[2] : "heat.ppm";
-		if (!(resfile = fopen(resfilename, "w")))
+		if (!(resfile = fopen(resfilename, "wb")))
 		{
 			fprintf(stderr, "\nError: Cannot open \"%s\" for writing.\n\n", resfilename);
 			MPI_Abort(MPI_COMM_WORLD, 1);
@@ -76,14 +146,60 @@ int main(int argc, char *argv[])
 	}
 	fclose(infile);
 
+	if (param.algorithm < 0 || param.algorithm > 4)
+	{
+		if (rank == 0)
+			fprintf(stderr, "\nError: Unknown algorithm %d.\n\n", param.algorithm);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
+	// kernels for the instruction set of this CPU
+	param.simd = simd_init(param.simd);
+
+	// deep halos are only implemented for the Jacobi sweep
+	if (param.algorithm != 0)
+		param.halo = 1;
+
+	// float storage only for the Jacobi sweep, single ghost layer and blocking exchange
+	if (param.algorithm != 0)
+		param.precision = 0;
+	if (param.precision > 0)
+	{
+		param.halo = 1;
+		param.overlap = 0;
+	}
+
+	// the ghost layers are interior points of the neighbours, so the halo
+	// depth is limited by the smallest local block of the smallest resolution
+	if (param.halo > 1)
+	{
+		int start, block[2];
+
+		decompose(param.initial_res, param.dims[0], param.coords[0], &start, &block[0]);
+		decompose(param.initial_res, param.dims[1], param.coords[1], &start, &block[1]);
+		MPI_Allreduce(MPI_IN_PLACE, block, 2, MPI_INT, MPI_MIN, param.comm);
+		if (block[1] < block[0])
+			block[0] = block[1];
+		if (block[0] < 1)
+			block[0] = 1;
+
+		if (param.halo > block[0])
+		{
+			if (rank == 0)
+				fprintf(stderr, "Warning: Halo depth %d exceeds the smallest local block, using %d\n",
+						param.halo, block[0]);
+			param.halo = block[0];
+		}
+	}
+
 	if (rank == 0)
 	{
 		print_params(&param);
+		fprintf(stderr, "Process grid      : %d x %d\n", param.dims[0], param.dims[1]);
+		if (provided < MPI_THREAD_FUNNELED)
+			fprintf(stderr, "Warning: MPI library does not support MPI_THREAD_FUNNELED\n");
 	}
-
-	// store MPI parameters for other functions
-	param.rank = rank;
-	param.size = size;
+	report_affinity(&param, pinned);
 
 	// set the visualization resolution
 	param.visres = 1024;
@@ -91,6 +207,15 @@ int main(int argc, char *argv[])
 	param.u = 0;
 	param.uhelp = 0;
 	param.uvis = 0;
+	param.arena.base = 0;
+	param.column_t = MPI_DATATYPE_NULL;
+	param.uf = 0;
+	param.uhelpf = 0;
+	param.column_float_t = MPI_DATATYPE_NULL;
+	param.mg_levels = 0;
+	param.mg_nlevels = 0;
+	param.cg.vec[0] = 0;
+	param.warm_buf = 0;
 
 	// allocate memory for visualization
 	if (rank == 0)
@@ -98,88 +223,321 @@ int main(int argc, char *argv[])
 		param.uvis = (double *)calloc(sizeof(double), (param.visres + 2) * (param.visres + 2));
 	}
 
+	// grids of all resolutions, allocated and faulted in once
+	if (!arena_setup(&param))
+	{
+		fprintf(stderr, "Rank %d: Error: Cannot allocate memory\n", rank);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+	if (rank == 0)
+		fprintf(stderr, "Grid arena        : %.1f MiB on rank 0, %s pages\n",
+				param.arena.bytes / 1048576.0, arena_page_names[param.arena.pages]);
+
+	// counters of all threads, the threads exist after arena_setup()
+	perf.nthreads = 0;
+	if (param.counters)
+	{
+		i = perf_open(&perf, &param);
+		if (rank == 0)
+			fprintf(stderr, "Hardware counters : %d of %d events available\n", i, PERF_EVENTS);
+		if (i == 0)
+			perf_close(&perf);
+	}
+
+	// memory bandwidth of all processes together, before the grids are used
+	roof.bandwidth = 0.0;
+	if (param.roofline && !roofline_probe(&param, &roof))
+		MPI_Abort(param.comm, 1);
+	if (rank == 0 && roof.bandwidth > 0.0)
+		fprintf(stderr, "Memory bandwidth  : %.2f GB/s STREAM triad, %.2f GB/s per process, %.2f GB/s per thread\n",
+				roof.bandwidth / 1e9, roof.bandwidth / 1e9 / size, roof.bandwidth / 1e9 / size / roof.threads);
+
+	// package and DRAM energy of all nodes
+	energy.nodes = 0;
+	if (param.energy && rank == 0)
+		fprintf(stderr, "Energy            : ");
+	if (param.energy && !energy_open(&energy, &param) && rank == 0)
+		fprintf(stderr, "RAPL counters not readable on all nodes, not measured\n");
+	else if (param.energy && rank == 0)
+		fprintf(stderr, "RAPL packages and DRAM of %d node(s)\n", energy.nodes);
+
+	// clocks of all processes are compared at the start and at the end
+	if (param.trace_file && !trace_init(&param, param.trace_events))
+		MPI_Abort(param.comm, 1);
+
+	// samples of the trials of a resolution
+	bench_init(&bench, param.bench_trials);
+	samples = (double *)malloc(sizeof(double) * param.bench_trials * BENCH_FIELDS);
+	if (!samples)
+	{
+		fprintf(stderr, "Rank %d: Error: Cannot allocate memory\n", rank);
+		MPI_Abort(MPI_COMM_WORLD, 1);
+	}
+
 	param.act_res = param.initial_res;
+	param.ckpt.active = 0;
+	resume = 0;
+
+	// continue the sweep at the resolution and iteration of the checkpoint
+	if (param.restart && !checkpoint_probe(&param, &resume))
+		MPI_Abort(MPI_COMM_WORLD, 1);
 
 	// loop over different resolutions
 	while (1)
 	{
 
-		// free allocated memory of previous experiment
-		if (param.u != 0)
-			finalize(&param);
+		for (trial = -param.bench_warmup; trial < param.bench_trials; trial++)
+		{
+			// free allocated memory of previous experiment
+			if (param.u != 0)
+				finalize(&param);
 
-		// Recalculate local resolution based on the new act_res, give additional rows for uneven division
-		param.local_act_res = param.act_res / param.size + (param.rank < param.act_res % param.size);
+			if (!initialize(&param))
+			{
+				fprintf(stderr, "Rank %d: Error in Jacobi initialization.\n\n", rank);
+				MPI_Abort(MPI_COMM_WORLD, 1);
+			}
 
-		if (!initialize(&param))
-		{
-			fprintf(stderr, "Rank %d: Error in Jacobi initialization.\n\n", rank);
-			MPI_Abort(MPI_COMM_WORLD, 1);
-		}
+			// initial guess from the previous resolution (nested iteration)
+			if (!warm_start(&param))
+				MPI_Abort(param.comm, 1);
 
-		if (rank == 0)
-			fprintf(stderr, "Resolution: %5u\r", param.act_res);
+			if (resume > 0 && !checkpoint_load(&param))
+			{
+				fprintf(stderr, "Rank %d: Error: Cannot read checkpoint \"%s\"\n", rank, param.ckpt_file);
+				MPI_Abort(MPI_COMM_WORLD, 1);
+			}
 
-		// full size (param.act_res are only the inner points)
-		np = param.act_res + 2;
+			if (rank == 0)
+				fprintf(stderr, "Resolution: %5u\r", param.act_res);
+
+			// full size of the local block (param.local_* are only the inner points)
+			np = param.local_cols + 2 * param.halo;
+			ny = param.local_rows + 2 * param.halo;
+
+			// starting time
+			MPI_Barrier(param.comm);
+			phase_reset();
+			param.float_sweeps = 0;
+			runtime = wtime();
+			perf_begin(&perf);
+			energy_begin(&energy);
+			residual = 999999999;
+			global_residual = residual;
+			check_req = MPI_REQUEST_NULL;
+			check_iter = 0;
+			extra = 0;
+
+			iter = iter0 = resume;
+			resume = 0;
+			while (1)
+			{
 
-		// starting time
-		MPI_Barrier(MPI_COMM_WORLD);
-		runtime = wtime();
-		residual = 999999999;
+				trace_step(param.act_res, iter);
+				t0 = wtime();
+				perf_kernel_begin(&perf);
+				switch (param.algorithm)
+				{
 
-		iter = 0;
-		while (1)
-		{
+				case 0: // JACOBI
 
-			switch (param.algorithm)
-			{
+					if (param.uf)
+					{
+						// float storage, double accumulation
+						residual = relax_jacobi_residual_float(param.uf, param.uhelpf, np, ny, &param);
+						float *tmpf = param.uf;
+						param.uf = param.uhelpf;
+						param.uhelpf = tmpf;
+						param.float_sweeps++;
+						break;
+					}
+
+					// relaxation and residual in a single pass over the grid
+					residual = relax_jacobi_residual(param.u, param.uhelp, np, ny, &param);
+					// swap u and uhelp
+					double *tmp = param.u;
+					param.u = param.uhelp;
+					param.uhelp = tmp;
+					break;
+
+				case 1: // GAUSS
+
+					relax_gauss(param.u, np, ny, &param);
+					perf_kernel_end(&perf, PERF_SWEEP);
+					perf_kernel_begin(&perf);
+					residual = residual_gauss(param.u, param.uhelp, np, ny, &param);
+					break;
+
+				case 2: // RED-BLACK GAUSS-SEIDEL
+
+					residual = relax_redblack(param.u, np, ny, &param);
+					break;
+
+				case 3: // MULTIGRID (one V-cycle per iteration)
+
+					residual = relax_multigrid(&param);
+					break;
+
+				case 4: // CONJUGATE GRADIENT
+
+					residual = relax_cg(&param);
+					break;
+				}
+				perf_kernel_end(&perf, param.algorithm == 1 ? PERF_RESIDUAL : PERF_SWEEP);
+				trace_event(TRACE_COMPUTE, t0, wtime());
+
+				iter++;
 
-			case 0: // JACOBI
+				if (param.algorithm == 4)
+				{
+					// CG reduces the residual together with its own dot products
+					global_residual = sqrt(residual);
 
-				relax_jacobi(param.u, param.uhelp, np, param.local_act_res + 2, &param);
-				if (iter > 0) // skip first iteration
+					// solution good enough ?
+					if (global_residual < 0.000005)
+						break;
+				}
+				else if (param.check_lag == 0)
 				{
-					residual = residual_jacobi(param.uhelp, np, param.local_act_res + 2, &param);
+					// blocking convergence check every check_every iterations
+					if (iter % param.check_every == 0)
+					{
+						t0 = wtime();
+						MPI_Allreduce(&residual, &global_residual, 1, MPI_DOUBLE, MPI_SUM, param.comm);
+						phase_add(PHASE_REDUCE, t0);
+						global_residual = sqrt(global_residual);
+						adapt_omega(&param, global_residual, iter);
+						mixed_check(&param, global_residual, 0.000005);
+
+						// solution good enough ?
+						if (global_residual < 0.000005)
+							break;
+					}
+				}
+				else
+				{
+					// lagged convergence check: the reduction started check_lag
+					// iterations ago is completed at the same iteration on all ranks
+					if (check_req != MPI_REQUEST_NULL && iter == check_iter + param.check_lag)
+					{
+						t0 = wtime();
+						MPI_Wait(&check_req, MPI_STATUS_IGNORE);
+						phase_add(PHASE_REDUCE, t0);
+						global_residual = sqrt(reduced_residual);
+						adapt_omega(&param, global_residual, check_iter);
+						mixed_check(&param, global_residual, 0.000005);
+
+						// solution good enough ?
+						if (global_residual < 0.000005)
+						{
+							extra = iter - check_iter;
+							break;
+						}
+					}
+
+					if (check_req == MPI_REQUEST_NULL && iter % param.check_every == 0)
+					{
+						local_residual = residual;
+						t0 = wtime();
+						MPI_Iallreduce(&local_residual, &reduced_residual, 1, MPI_DOUBLE, MPI_SUM, param.comm, &check_req);
+						phase_add(PHASE_REDUCE, t0);
+						check_iter = iter;
+					}
 				}
-				// swap u and uhelp
-				double *tmp = param.u;
-				param.u = param.uhelp;
-				param.uhelp = tmp;
-				break;
 
-			case 1: // GAUSS
+				// max. iteration reached ? (no limit with maxiter=0)
+				if (param.maxiter > 0 && iter >= param.maxiter)
+					break;
 
-				relax_gauss(param.u, np, param.local_act_res + 2, &param);
-				residual = residual_gauss(param.u, param.uhelp, np, param.local_act_res + 2, &param);
-				break;
+				// written while the next sweeps run, so never for a finished
+				// resolution, which a restart would sweep once more
+				if (param.ckpt_every > 0 && iter % param.ckpt_every == 0 &&
+					!checkpoint_begin(&param, iter))
+					MPI_Abort(param.comm, 1);
 			}
 
-			iter++;
-
-			MPI_Allreduce(&residual, &global_residual, 1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-			global_residual = sqrt(global_residual);
+			// complete a reduction still in flight
+			if (check_req != MPI_REQUEST_NULL)
+			{
+				t0 = wtime();
+				MPI_Wait(&check_req, MPI_STATUS_IGNORE);
+				phase_add(PHASE_REDUCE, t0);
+				global_residual = sqrt(reduced_residual);
+			}
 
-			// solution good enough ?
-			if (global_residual < 0.000005)
-				break;
+			checkpoint_end(&param);
+
+			// Flop count of the <i> iterations of this run (without those before a restart)
+			// (fused Jacobi: 7 per point, red-black SOR: 9 per point, Gauss-Seidel SOR + residual: 13 per point)
+			flop = (iter - iter0) * (param.algorithm == 1 ? 13.0 : param.algorithm == 2 ? 9.0 : 7.0) * param.act_res * param.act_res;
+			if (param.algorithm == 3)
+				flop = (iter - iter0) * flops_multigrid() * param.act_res * param.act_res;
+			if (param.algorithm == 4)
+				flop = (iter - iter0) * flops_cg(&param) * param.act_res * param.act_res;
+			// stopping time
+			runtime = wtime() - runtime;
+			perf_end(&perf);
+			joules = energy_end(&energy, &param);
+
+			// the result is handed on in double precision, not part of the solve
+			mixed_to_double(&param);
+
+			// visualization gather of the trial, timed by the harness only
+			if (param.bench_file)
+			{
+				t0 = wtime();
+				if (!gather_image_begin(&param, &gather))
+					MPI_Abort(param.comm, 1);
+				gather_image_end(&param, &gather, &visx, &visy);
+				phase_add(PHASE_GATHER, t0);
+			}
 
-			// max. iteration reached ? (no limit with maxiter=0)
-			if (param.maxiter > 0 && iter >= param.maxiter)
-				break;
+			// times of the slowest process, the warm-up runs are not recorded
+			sample[0] = runtime;
+			sample[1] = runtime - phase_time[PHASE_HALO] - phase_time[PHASE_REDUCE];
+			for (i = 0; i < NPHASES; i++)
+				sample[2 + i] = phase_time[i];
+			if (trial >= 0)
+				MPI_Reduce(sample, samples + trial * BENCH_FIELDS, BENCH_FIELDS, MPI_DOUBLE, MPI_MAX, 0, param.comm);
 		}
 
-		// Flop count after <i> iterations
-		flop = iter * 11.0 * param.act_res * param.act_res;
-		// stopping time
-		runtime = wtime() - runtime;
+		// points updated redundantly in the deep ghost layers
+		MPI_Reduce(&param.redundant_points, &redundant, 1, MPI_DOUBLE, MPI_SUM, 0, param.comm);
 
 		if (rank == 0)
 		{
 			fprintf(stderr, "Resolution: %5u, ", param.act_res);
 			fprintf(stderr, "Time: %04.3f ", runtime);
 			fprintf(stderr, "(%3.3f GFlop => %6.2f MFlop/s, ", flop / 1000000000.0, flop / runtime / 1000000);
-			fprintf(stderr, "residual %f, %d iterations)\n", global_residual, iter);
+			fprintf(stderr, "residual %f, %d iterations", global_residual, iter);
+			if (param.check_lag > 0)
+				fprintf(stderr, ", %u extra sweeps", extra);
+			if (param.halo > 1)
+				fprintf(stderr, ", %.2f%% redundant flops",
+						100.0 * redundant / ((double)iter * param.act_res * param.act_res));
+			fprintf(stderr, ")\n");
+			if (energy.nodes && joules > 0.0)
+				fprintf(stderr, "            energy  : %.2f J, %.1f W average, %.2f MFlop/J\n",
+						joules, joules / runtime, flop / joules / 1000000);
+
+			// the median of the trials goes into the table
+			if (param.bench_trials > 1)
+			{
+				bench_stats(samples, param.bench_trials, BENCH_FIELDS, &tmin, &tmedian, &tmean, &tstddev);
+				fprintf(stderr, "            %d trials: min %04.3f, median %04.3f, stddev %04.3f",
+						param.bench_trials, tmin, tmedian, tstddev);
+				for (i = 1; i < BENCH_FIELDS; i++)
+				{
+					bench_stats(samples + i, param.bench_trials, BENCH_FIELDS, &tmin, &tmedian, &tmean, &tstddev);
+					fprintf(stderr, "%s%s %04.3f", i == 1 ? " (median " : ", ", bench_field_names[i], tmedian);
+				}
+				fprintf(stderr, ")\n");
+				bench_stats(samples, param.bench_trials, BENCH_FIELDS, &tmin, &runtime, &tmean, &tstddev);
+			}
+			roofline_report(&roof, &param, runtime, flop, iter - iter0);
+
+			if (param.bench_file && !bench_add(&bench, param.act_res, iter, flop, samples))
+				MPI_Abort(param.comm, 1);
 
 			// for plot...
 			time[experiment] = runtime;
@@ -188,96 +546,74 @@ int main(int argc, char *argv[])
 			experiment++;
 		}
 
+		// counters of the last trial, with its own time
+		perf_report(&perf, &param, sample[0], flop, iter - iter0);
+
 		if (param.act_res + param.res_step_size > param.max_res)
 			break;
+
+		// the solution is the initial guess of the next resolution
+		if (param.nested && !warm_save(&param))
+			MPI_Abort(param.comm, 1);
 		param.act_res += param.res_step_size;
 	}
 
 	// --- GATHERING PHASE ---
-	int *counts = NULL;
-	int *displs = NULL;
-	double *uvis_local = NULL;
-	int stepy;
-
-	if (param.act_res > param.visres)
-		stepy = param.act_res / param.visres;
-	else
-	{
-		stepy = 1;
-	}
+	// the coarse image is gathered while the field is dumped and the
+	// results are printed
+	trace_step(param.act_res, iter);
+	t0 = wtime();
+	if (!gather_image_begin(&param, &gather))
+		MPI_Abort(param.comm, 1);
 
-	int local_coarse_rows = 0;
-	// exchange by direct calculation??
-	for (int i = param.start_y; i < param.start_y + param.local_act_res; i += stepy)
-		local_coarse_rows++;
-	uvis_local = malloc(local_coarse_rows * (param.visres + 2) * sizeof(double));
-
-	coarsen(param.u + np, np, param.local_act_res, uvis_local, param.visres + 2, param.visres + 2, param.start_y, param.local_act_res, stepy);
+	// full resolution field, written by all processes
+	if (param.dumpfile && !dump_field(&param, param.dumpfile))
+		MPI_Abort(param.comm, 1);
 
+	// --- FINALIZATION ---
 	if (rank == 0)
 	{
-		// Root process allocates memory for the global grid and description arrays
-		counts = (int *)malloc(sizeof(int) * size);
-		displs = (int *)malloc(sizeof(int) * size);
-
-		// Calculate the counts and displacements for MPI_Gatherv
-		int sum = 0;
-		int int_act_res = param.act_res;
-		for (i = 0; i < size; i++)
-		{
-			int rows = int_act_res / size + (i < int_act_res % size);
-			counts[i] = rows * np;
-			displs[i] = sum;
-			sum += counts[i];
-		}
-	}
-
-	// Compute recvcounts and displs
-	if (0 == rank)
-	{
-		int offset = 0;
-		for (int r = 0; r < param.size; r++)
+		for (i = 0; i < experiment; i++)
 		{
-			int base_rows = param.act_res / param.size;
-			int extra = param.act_res % param.size;
-			int start_y = r * base_rows + (r < extra ? r : extra);
-
-			int rows = 0;
-			for (int i = start_y; i < start_y + base_rows + (r < extra); i += stepy)
-				rows++;
-
-			counts[r] = rows * (param.visres + 2);
-			displs[r] = offset;
-			offset += counts[r];
+			printf("%5d; %5.3f; %5.3f\n", resolution[i], time[i], floprate[i]);
 		}
 	}
 
-	// Gather local coarsenings in rank 0
-	MPI_Gatherv(
-		uvis_local, local_coarse_rows * (param.visres + 2), MPI_DOUBLE, param.uvis, counts, displs, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+	gather_image_end(&param, &gather, &visx, &visy);
+	trace_event(PHASE_GATHER, t0, wtime());
 
-	// --- FINALIZATION ---
-	free(uvis_local);
 	if (rank == 0)
 	{
-		for (i = 0; i < experiment; i++)
-		{
-			printf("%5d; %5.3f; %5.3f\n", resolution[i], time[i], floprate[i]);
-		}
-
-		write_image(resfile, param.uvis, param.visres + 2, param.visres + 2);
+		if (strlen(resfilename) > 4 && strcmp(resfilename + strlen(resfilename) - 4, ".pfm") == 0)
+			write_field(resfile, param.uvis, visx, visy);
+		else
+			write_image(resfile, param.uvis, visx, visy);
 
 		// Clean up buffers
 		fclose(resfile);
-		free(counts);
-		free(displs);
 	}
 
+	if (rank == 0 && param.bench_file && !bench_write(&bench, &param, param.bench_file))
+		MPI_Abort(param.comm, 1);
+	bench_free(&bench);
+
+	// all events of all processes on the clock of rank 0
+	if (param.trace_file && !trace_write(&param, param.trace_file))
+		MPI_Abort(param.comm, 1);
+	trace_free();
+	if (perf.nthreads)
+		perf_close(&perf);
+	energy_close(&energy);
+	free(samples);
+
 	finalize(&param);
+	arena_free(&param);
+	free(param.warm_buf);
 
 	if (rank == 0)
 		free(param.uvis);
 
+	MPI_Comm_free(&param.comm);
 	MPI_Finalize();
 
 	return 0;
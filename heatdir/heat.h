@@ -8,6 +8,7 @@
 #define JACOBI_H_INCLUDED
 
 #include <stdio.h>
+#include <mpi.h>
 
 // configuration
 
@@ -19,6 +20,36 @@ typedef struct
     float temp;
 } heatsrc_t;
 
+typedef struct mglevel mglevel_t;
+
+// state of the conjugate gradient solver kept between iterations
+typedef struct
+{
+    double *vec[9]; // work vectors, see cg.c
+    double rho;     // (r, M^-1 r) of the previous iteration
+    double alpha;   // step length of the previous iteration
+    double omega;   // SSOR relaxation factor
+    int started;    // 0=>initial residual not computed yet
+} cgstate_t;
+
+// persistent memory of u and uhelp, see arena.c
+typedef struct
+{
+    char *base;      // mapping of both grids
+    size_t bytes;    // size of the mapping
+    int pages;       // 0=>4 KiB, 1=>transparent huge pages, 2=>explicit huge pages
+    double *grid[2]; // u and uhelp
+} arena_t;
+
+// checkpoint in flight, see checkpoint.c
+typedef struct ckptjob ckptjob_t;
+typedef struct
+{
+    int active;     // 1=>write started, not completed yet
+    ckptjob_t *job; // snapshot and helper thread of the write
+    double omega;   // SOR factor read by checkpoint_probe()
+} ckpt_t;
+
 typedef struct
 {
     unsigned maxiter; // maximum number of iterations
@@ -26,40 +57,296 @@ typedef struct
     unsigned max_res; // spatial resolution
     unsigned initial_res;
     unsigned res_step_size;
-    int algorithm; // 0=>Jacobi, 1=>Gauss
+    int algorithm; // 0=>Jacobi, 1=>Gauss, 2=>Red-Black Gauss-Seidel, 3=>Multigrid, 4=>CG
+    int overlap;     // 1=>overlap halo exchange with interior update
+    int check_every; // reduce the residual every check_every iterations
+    int check_lag;   // 0=>blocking MPI_Allreduce, >0=>MPI_Iallreduce completed check_lag iterations later
+    int halo;        // ghost layers per side, Jacobi exchanges every halo sweeps
+    int tile;        // column strip width of the Jacobi sweep, 0=>whole rows
+    int gs_block;    // column block width of the Gauss-Seidel pipeline, 0=>whole rows
+    int mg_smoother; // multigrid smoother 0=>Red-Black Gauss-Seidel, 1=>damped Jacobi
+    double omega;     // over-relaxation factor of Gauss-Seidel and Red-Black
+    int omega_mode;   // 0=>fixed omega, 1=>optimal 2/(1+sin(pi h)), 2=>adapted to the residual decay
+    int precision;    // 0=>double, 1=>float storage, 2=>float refined in double near the threshold
+    int simd;         // stencil kernels 0=>scalar, 1=>AVX2, 2=>AVX-512, -1=>best supported
+    int simd_stream;  // 1=>non-temporal stores to the Jacobi target grid
+    int cg_precond;  // CG preconditioner 0=>none, 1=>Jacobi, 2=>SSOR
+    int cg_pipelined; // 1=>pipelined CG with a single reduction per iteration
+    int huge_pages;   // grid arena 0=>4 KiB pages, 1=>transparent huge pages, 2=>explicit huge pages
+
+    unsigned sweep;          // sweeps since initialize(), for the deep halo
+    double redundant_points; // points recomputed in the ghost layers
+
+    double omega_res;    // reference residual of the adaptive SOR factor
+    unsigned omega_iter; // iteration of omega_res, 0=>none yet
+
+    mglevel_t *mg_levels; // multigrid hierarchy, level 0 is the fine grid
+    int mg_nlevels;
+
+    cgstate_t cg; // conjugate gradient vectors and scalars
 
     unsigned visres; // visualization resolution
+    char *dumpfile;  // full resolution field written with MPI-IO, 0=>none
+
+    char *ckpt_file; // checkpoint file, 0=>none
+    int ckpt_every;  // checkpoint every ckpt_every iterations, 0=>never
+    int restart;     // 1=>resume from ckpt_file
+    ckpt_t ckpt;
 
+    int nested;       // 1=>start from the interpolated solution of the previous resolution
+    double *warm_buf; // owned points of the previous solution, 0=>none
+    int warm_res;     // resolution of warm_buf
+
+    int bench_trials;  // timed runs of every resolution
+    int bench_warmup;  // untimed runs before the trials
+    char *bench_file;  // JSON or CSV (*.csv) summary of the trials, 0=>none
+    int counters;      // 1=>hardware counters of the timed region, see perfctr.c
+    char *trace_file;  // Chrome trace of the phases of all processes, 0=>none
+    long trace_events; // ring buffer capacity per process
+    int roofline;      // 1=>measure the memory bandwidth at startup, see roofline.c
+    int energy;        // 1=>energy of every resolution from RAPL, see energy.c
+
+    arena_t arena; // u and uhelp of all resolutions
     double *u, *uhelp;
     double *uvis;
 
+    float *uf, *uhelpf;          // float grids of the mixed-precision mode, u/uhelp are 0 meanwhile
+    double prev_residual;        // last global residual of the mixed-precision mode
+    unsigned float_sweeps;       // sweeps of the timed run on the float grids
+    MPI_Datatype column_float_t; // column_t for the float grids
+
     unsigned numsrcs; // number of heat sources
     heatsrc_t *heatsrcs;
 
     // --- MPI-specific parameters for decomposition ---
-    int rank, size;      // MPI rank and size of communicator
-    int local_act_res;   // Number of rows for this process's sub-grid
-    int start_y;         // Global starting row index for this process
-    int top_neighbor;    // Rank of the process above (-1 if none)
-    int bottom_neighbor; // Rank of the process below (-1 if none)
+    int rank, size;        // MPI rank and size of communicator
+    MPI_Comm comm;         // 2D Cartesian communicator
+    int dims[2];           // process grid (rows x columns), 0 => MPI_Dims_create
+    int coords[2];         // coordinates of this process in the process grid
+    int local_rows;        // Number of interior rows of this process's block
+    int local_cols;        // Number of interior columns of this process's block
+    int ld;                // row stride of the local grids (>= local_cols + 2 * halo), see arena.c
+    int start_y;           // Global starting row index for this process
+    int start_x;           // Global starting column index for this process
+    int top_neighbor;      // Rank of the process above (MPI_PROC_NULL if none)
+    int bottom_neighbor;   // Rank of the process below (MPI_PROC_NULL if none)
+    int left_neighbor;     // Rank of the process to the left (MPI_PROC_NULL if none)
+    int right_neighbor;    // Rank of the process to the right (MPI_PROC_NULL if none)
+    MPI_Datatype column_t; // halo interior columns of the local block
 } algoparam_t;
 
+// visualization gather in flight, see gather_image_begin()
+typedef struct
+{
+    MPI_Request req;
+    int step;                     // fine points per coarse point and direction
+    unsigned visx, visy;          // size of the coarse image
+    double *local;                // box sums of this process
+    int *blocks, *counts, *displs; // coarse blocks of all processes (rank 0)
+    double *staging;              // received blocks (rank 0)
+} gather_t;
+
+// timed trials of all resolutions, see bench.c
+typedef struct
+{
+    int nres;         // resolutions recorded
+    int trials;       // trials per resolution
+    unsigned *res;    // resolution,
+    unsigned *iter;   // iterations
+    double *flop;     // and Flop count of every resolution
+    double *samples;  // nres x trials x BENCH_FIELDS times of the slowest process
+} bench_t;
+
+// fields of a sample: total solve time, compute sweep, then the phases of timing.h
+#define BENCH_FIELDS 5
+
+// hardware counters of all threads, see perfctr.c
+enum
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_LLC_MISSES,
+    PERF_FP_SCALAR, // double-precision FP instructions: scalar,
+    PERF_FP_128,    // 128 bit,
+    PERF_FP_256,    // 256 bit,
+    PERF_FP_512,    // 512 bit
+    PERF_EVENTS
+};
+
+// kernels counted separately within the timed region
+enum
+{
+    PERF_SWEEP,    // iteration of the algorithm, including its halo exchange
+    PERF_RESIDUAL, // separate residual computation (Gauss-Seidel)
+    PERF_KERNELS
+};
+
+typedef struct
+{
+    int nthreads;                             // threads with counters, 0=>counters off
+    int *fd;                                  // nthreads x PERF_EVENTS, -1=>not opened
+    int available[PERF_EVENTS];               // 1=>opened on all threads of all processes
+    double start[PERF_EVENTS];                // counts at perf_begin()
+    double kstart[PERF_EVENTS];               // counts at perf_kernel_begin()
+    double region[PERF_EVENTS];               // counts of the timed region
+    double kernel[PERF_KERNELS][PERF_EVENTS]; // counts of the kernels in it
+} perf_t;
+
+// measured memory bandwidth, see roofline.c
+typedef struct
+{
+    double bandwidth; // triad bytes/s of all processes, 0=>not measured
+    long n;           // elements per array and process
+    int node_size;    // processes sharing a node
+    int threads;      // threads per process
+} roofline_t;
+
+// RAPL energy counters of this node, see energy.c
+#define ENERGY_DOMAINS 16
+typedef struct
+{
+    int n;                        // counters read by this process (first process of a node)
+    int fd[ENERGY_DOMAINS];       // energy_uj of packages and DRAM
+    double range[ENERGY_DOMAINS]; // max_energy_range_uj, wrap around
+    double start[ENERGY_DOMAINS]; // microjoules at energy_begin()
+    int nodes;                    // nodes measured, 0=>no energy measurement
+} energy_t;
+
+// one level of the multigrid hierarchy
+struct mglevel
+{
+    int n;                   // global interior points per direction
+    int serial;              // 1=>level gathered onto rank 0
+    int active;              // 1=>this rank holds part of the level
+    algoparam_t p;           // local block and neighbors on this level
+    double *x;               // coordinates of the points 0..n+1 in fine mesh widths
+    double *cw, *ce;         // stencil weights towards the lower/higher neighbor
+    double *wl;              // interpolation weight of the lower coarse point
+    double *u, *b, *r, *tmp; // correction, right-hand side, residual, scratch
+};
+
 // function declarations
 
 // misc.c
+int create_topology(algoparam_t *param);
+void decompose(int n, int parts, int idx, int *start, int *count);
+void owned_range(algoparam_t *param, int res, int coords[2], int *lo_y, int *hi_y, int *lo_x, int *hi_x);
+void copy_owned(algoparam_t *param, double *buf, int to);
 int initialize(algoparam_t *param);
 int finalize(algoparam_t *param);
 void write_image(FILE *f, double *u,
                  unsigned sizex, unsigned sizey);
-int coarsen(double *uold, unsigned oldx, unsigned oldy,
-            double *unew, unsigned newx, unsigned newy, int start_y, int local_act_res, int stepy);
+void write_field(FILE *f, double *u,
+                 unsigned sizex, unsigned sizey);
+int dump_field(algoparam_t *param, const char *filename);
+int coarsen(double *uold, unsigned oldx,
+            double *unew, unsigned newx,
+            int first_row, int rows, int first_col, int cols,
+            int lo_y, int hi_y, int lo_x, int hi_x,
+            int start_y, int start_x, int step);
+int gather_image_begin(algoparam_t *param, gather_t *gather);
+void gather_image_end(algoparam_t *param, gather_t *gather, unsigned *visx, unsigned *visy);
+
+// arena.c
+extern const char *arena_page_names[];
+int arena_stride(int sizex);
+int arena_setup(algoparam_t *param);
+void arena_free(algoparam_t *param);
+
+// checkpoint.c
+int checkpoint_begin(algoparam_t *param, unsigned iter);
+void checkpoint_end(algoparam_t *param);
+int checkpoint_probe(algoparam_t *param, unsigned *iter);
+int checkpoint_load(algoparam_t *param);
+
+// Nested iteration: warmstart.c
+int warm_save(algoparam_t *param);
+int warm_start(algoparam_t *param);
+
+// Benchmark harness: bench.c
+extern const char *bench_field_names[BENCH_FIELDS];
+void bench_init(bench_t *bench, int trials);
+int bench_add(bench_t *bench, unsigned res, unsigned iter, double flop, const double *samples);
+void bench_stats(const double *x, int n, int stride, double *min, double *median, double *mean, double *stddev);
+int bench_write(bench_t *bench, algoparam_t *param, const char *filename);
+void bench_free(bench_t *bench);
+
+// Hardware counters: perfctr.c
+extern const char *perf_kernel_names[PERF_KERNELS];
+int perf_open(perf_t *perf, algoparam_t *param);
+void perf_close(perf_t *perf);
+void perf_begin(perf_t *perf);
+void perf_end(perf_t *perf);
+void perf_kernel_begin(perf_t *perf);
+void perf_kernel_end(perf_t *perf, int k);
+void perf_report(perf_t *perf, algoparam_t *param, double runtime, double flop, unsigned iter);
+
+// Timeline of the phases: trace.c (recording in timing.h)
+int trace_init(algoparam_t *param, long capacity);
+int trace_write(algoparam_t *param, const char *filename);
+void trace_free(void);
+
+// Memory bandwidth and traffic model: roofline.c
+int roofline_probe(algoparam_t *param, roofline_t *roof);
+double bytes_per_update(algoparam_t *param);
+void roofline_report(roofline_t *roof, algoparam_t *param, double runtime, double flop, unsigned iter);
+
+// Energy to solution: energy.c
+int energy_open(energy_t *energy, algoparam_t *param);
+void energy_close(energy_t *energy);
+void energy_begin(energy_t *energy);
+double energy_end(energy_t *energy, algoparam_t *param);
+
+// affinity.c
+int bind_threads(void);
+void report_affinity(algoparam_t *param, int pinned);
+
+// stencil row kernels selected by simd_init(): simd.c
+extern const char *simd_names[];
+int simd_init(int level);
+extern void (*jacobi_row)(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt);
+extern double (*jacobi_residual_row)(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt);
+extern double (*redblack_row)(double *restrict urow, int ld, int j0, int j1, double omega);
+extern double (*jacobi_residual_row_float)(const float *restrict urow, float *restrict trow, int ld, int j0, int j1);
+
+// halo.c
+void exchange_halo(double *u, unsigned sizex, unsigned sizey, algoparam_t *param);
+void exchange_halo_begin(double *u, unsigned sizex, unsigned sizey, algoparam_t *param, MPI_Request req[8]);
+void exchange_halo_end(MPI_Request req[8]);
+
+void exchange_halo_float(float *u, unsigned sizex, unsigned sizey, algoparam_t *param);
+
+// Mixed-precision Jacobi: mixed.c
+int mixed_setup(algoparam_t *param);
+void mixed_to_double(algoparam_t *param);
+void mixed_check(algoparam_t *param, double residual, double threshold);
+void mixed_free(algoparam_t *param);
+double relax_jacobi_residual_float(float *restrict u, float *restrict utmp, unsigned sizex, unsigned sizey, algoparam_t *param);
 
 // Gauss-Seidel: relax_gauss.c
 double residual_gauss(double *u, double *utmp, unsigned sizex, unsigned sizey, algoparam_t *param);
 void relax_gauss(double *u, unsigned sizex, unsigned sizey, algoparam_t *param);
+void adapt_omega(algoparam_t *param, double residual, unsigned iter);
+
+// Red-Black Gauss-Seidel: relax_redblack.c
+double relax_redblack(double *u, unsigned sizex, unsigned sizey, algoparam_t *param);
+
+// Multigrid: multigrid.c
+int mg_setup(algoparam_t *param);
+void mg_free(algoparam_t *param);
+double relax_multigrid(algoparam_t *param);
+double flops_multigrid(void);
+double bytes_multigrid(algoparam_t *param);
+
+// Conjugate Gradient: cg.c
+int cg_setup(algoparam_t *param);
+void cg_free(algoparam_t *param);
+double relax_cg(algoparam_t *param);
+double flops_cg(algoparam_t *param);
+double bytes_cg(algoparam_t *param);
 
 // Jacobi: relax_jacobi.c
-double residual_jacobi(double *u, unsigned sizex, unsigned sizey, algoparam_t *param);
 void relax_jacobi(double *u, double *utmp, unsigned sizex, unsigned sizey, algoparam_t *param);
+double relax_jacobi_residual(double *restrict u, double *restrict utmp, unsigned sizex, unsigned sizey, algoparam_t *param);
 
 #endif // JACOBI_H_INCLUDED/
\ No newline at end of file
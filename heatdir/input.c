@@ -4,11 +4,245 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
 
 #include "input.h"
 
 #define BUFSIZE 100
 
+/*
+ * Parse the command line options into param.
+ * Returns the index of the first positional argument, -1 on error.
+ */
+int read_options(int argc, char *argv[], algoparam_t *param)
+{
+  static struct option long_options[] = {
+      {"overlap", no_argument, 0, 'o'},
+      {"check-every", required_argument, 0, 'c'},
+      {"check-lag", required_argument, 0, 'l'},
+      {"halo-depth", required_argument, 0, 'd'},
+      {"tile", required_argument, 0, 't'},
+      {"gs-block", required_argument, 0, 'b'},
+      {"smoother", required_argument, 0, 's'},
+      {"omega", required_argument, 0, 'w'},
+      {"precision", required_argument, 0, 'f'},
+      {"simd", required_argument, 0, 'v'},
+      {"nt-stores", no_argument, 0, 'n'},
+      {"nested", no_argument, 0, 'N'},
+      {"checkpoint", required_argument, 0, 'C'},
+      {"checkpoint-every", required_argument, 0, 'K'},
+      {"restart", no_argument, 0, 'r'},
+      {"dump", required_argument, 0, 'D'},
+      {"huge-pages", required_argument, 0, 'H'},
+      {"precond", required_argument, 0, 'p'},
+      {"pipelined", no_argument, 0, 'P'},
+      {"trials", required_argument, 0, 'T'},
+      {"warmup", required_argument, 0, 'W'},
+      {"bench", required_argument, 0, 'B'},
+      {"counters", no_argument, 0, 'e'},
+      {"trace", required_argument, 0, 'R'},
+      {"trace-events", required_argument, 0, 'E'},
+      {"roofline", no_argument, 0, 'S'},
+      {"energy", no_argument, 0, 'J'},
+      {0, 0, 0, 0}};
+  int c;
+
+  // defaults
+  param->overlap = 0;
+  param->check_every = 1;
+  param->check_lag = 0;
+  param->halo = 1;
+  param->tile = 0;
+  param->gs_block = 0;
+  param->mg_smoother = 0;
+  param->omega = 1.0;
+  param->omega_mode = 0;
+  param->precision = 0;
+  param->huge_pages = 0;
+  param->dumpfile = 0;
+  param->nested = 0;
+  param->ckpt_file = 0;
+  param->ckpt_every = 0;
+  param->restart = 0;
+  param->simd = -1;
+  param->simd_stream = 0;
+  param->cg_precond = 1;
+  param->cg_pipelined = 0;
+  param->bench_trials = 1;
+  param->bench_warmup = 0;
+  param->bench_file = 0;
+  param->counters = 0;
+  param->trace_file = 0;
+  param->trace_events = 1 << 16;
+  param->roofline = 0;
+  param->energy = 0;
+
+  opterr = 0;
+  while ((c = getopt_long(argc, argv, "oc:l:d:t:b:s:w:f:v:nNC:K:rD:H:p:PT:W:B:eR:E:SJ", long_options, NULL)) != -1)
+  {
+    switch (c)
+    {
+    case 'o':
+      param->overlap = 1;
+      break;
+    case 'c':
+      param->check_every = atoi(optarg);
+      if (param->check_every < 1)
+        return -1;
+      break;
+    case 'l':
+      param->check_lag = atoi(optarg);
+      if (param->check_lag < 0)
+        return -1;
+      break;
+    case 'd':
+      param->halo = atoi(optarg);
+      if (param->halo < 1)
+        return -1;
+      break;
+    case 't':
+      param->tile = atoi(optarg);
+      if (param->tile < 0)
+        return -1;
+      break;
+    case 'b':
+      param->gs_block = atoi(optarg);
+      if (param->gs_block < 0)
+        return -1;
+      break;
+    case 's':
+      if (strcmp(optarg, "redblack") == 0)
+        param->mg_smoother = 0;
+      else if (strcmp(optarg, "jacobi") == 0)
+        param->mg_smoother = 1;
+      else
+        return -1;
+      break;
+    case 'w':
+      if (strcmp(optarg, "opt") == 0)
+        param->omega_mode = 1;
+      else if (strcmp(optarg, "adapt") == 0)
+        param->omega_mode = 2;
+      else
+      {
+        param->omega_mode = 0;
+        param->omega = atof(optarg);
+        if (param->omega <= 0.0 || param->omega >= 2.0)
+          return -1;
+      }
+      break;
+    case 'f':
+      if (strcmp(optarg, "double") == 0)
+        param->precision = 0;
+      else if (strcmp(optarg, "float") == 0)
+        param->precision = 1;
+      else if (strcmp(optarg, "mixed") == 0)
+        param->precision = 2;
+      else
+        return -1;
+      break;
+    case 'v':
+      if (strcmp(optarg, "auto") == 0)
+        param->simd = -1;
+      else if (strcmp(optarg, "scalar") == 0)
+        param->simd = 0;
+      else if (strcmp(optarg, "avx2") == 0)
+        param->simd = 1;
+      else if (strcmp(optarg, "avx512") == 0)
+        param->simd = 2;
+      else
+        return -1;
+      break;
+    case 'n':
+      param->simd_stream = 1;
+      break;
+    case 'N':
+      param->nested = 1;
+      break;
+    case 'C':
+      param->ckpt_file = optarg;
+      break;
+    case 'K':
+      param->ckpt_every = atoi(optarg);
+      if (param->ckpt_every < 0)
+        return -1;
+      break;
+    case 'r':
+      param->restart = 1;
+      break;
+    case 'D':
+      param->dumpfile = optarg;
+      break;
+    case 'H':
+      if (strcmp(optarg, "none") == 0)
+        param->huge_pages = 0;
+      else if (strcmp(optarg, "thp") == 0)
+        param->huge_pages = 1;
+      else if (strcmp(optarg, "hugetlb") == 0)
+        param->huge_pages = 2;
+      else
+        return -1;
+      break;
+    case 'p':
+      if (strcmp(optarg, "none") == 0)
+        param->cg_precond = 0;
+      else if (strcmp(optarg, "jacobi") == 0)
+        param->cg_precond = 1;
+      else if (strcmp(optarg, "ssor") == 0)
+        param->cg_precond = 2;
+      else
+        return -1;
+      break;
+    case 'P':
+      param->cg_pipelined = 1;
+      break;
+    case 'T':
+      param->bench_trials = atoi(optarg);
+      if (param->bench_trials < 1)
+        return -1;
+      break;
+    case 'W':
+      param->bench_warmup = atoi(optarg);
+      if (param->bench_warmup < 0)
+        return -1;
+      break;
+    case 'B':
+      param->bench_file = optarg;
+      break;
+    case 'e':
+      param->counters = 1;
+      break;
+    case 'R':
+      param->trace_file = optarg;
+      break;
+    case 'S':
+      param->roofline = 1;
+      break;
+    case 'J':
+      param->energy = 1;
+      break;
+    case 'E':
+      param->trace_events = atol(optarg);
+      if (param->trace_events < 1 || param->trace_events > (1L << 24))
+        return -1;
+      break;
+    default:
+      return -1;
+    }
+  }
+
+  // checkpoints and restart need a file
+  if ((param->ckpt_every > 0 || param->restart) && !param->ckpt_file)
+    return -1;
+
+  // a restart resumes a single run, not repeated trials
+  if (param->restart && param->bench_trials + param->bench_warmup > 1)
+    return -1;
+
+  return optind;
+}
+
 int read_input(FILE *infile, algoparam_t *param)
 {
   int i, n;
@@ -63,8 +297,12 @@ int read_input(FILE *infile, algoparam_t *param)
   return 1;
 }
 
+const char *algorithm_names[] = {"Jacobi", "Gauss-Seidel", "Red-Black Gauss-Seidel", "Multigrid",
+                                 "Conjugate Gradient"};
+
 void print_params(algoparam_t *param)
 {
+  static const char *preconds[] = {"none", "Jacobi", "block SSOR"};
   int i;
 
   fprintf(stderr, "Resolutions       : (%u, %u, ... %u)\n",
@@ -74,7 +312,65 @@ void print_params(algoparam_t *param)
   fprintf(stderr, "Iterations        : %u\n", param->maxiter);
   fprintf(stderr, "Algorithm         : %d (%s)\n",
           param->algorithm,
-          (param->algorithm == 0) ? "Jacobi" : "Gauss-Jacobi");
+          algorithm_names[param->algorithm]);
+  fprintf(stderr, "Halo exchange     : %s, depth %d\n",
+          (param->overlap && param->halo == 1) ? "nonblocking, overlapped" : "blocking",
+          param->halo);
+  if (param->precision == 1)
+    fprintf(stderr, "Precision         : float storage, double accumulation\n");
+  else if (param->precision == 2)
+    fprintf(stderr, "Precision         : float storage, refined in double near the threshold\n");
+  fprintf(stderr, "Stencil kernels   : %s%s\n", simd_names[param->simd],
+          param->simd_stream ? ", non-temporal stores" : "");
+  fprintf(stderr, "Residual check    : every %d iteration(s), ", param->check_every);
+  if (param->check_lag > 0)
+    fprintf(stderr, "nonblocking, lag %d\n", param->check_lag);
+  else
+    fprintf(stderr, "blocking\n");
+  if (param->algorithm == 0)
+  {
+    if (param->tile > 0)
+      fprintf(stderr, "Tiled sweep       : %d columns\n", param->tile);
+    else
+      fprintf(stderr, "Tiled sweep       : whole rows\n");
+  }
+  if (param->algorithm == 1)
+  {
+    if (param->gs_block > 0)
+      fprintf(stderr, "Pipeline blocks   : %d columns\n", param->gs_block);
+    else
+      fprintf(stderr, "Pipeline blocks   : whole rows\n");
+  }
+  if (param->algorithm == 1 || param->algorithm == 2)
+  {
+    if (param->omega_mode == 1)
+      fprintf(stderr, "Over-relaxation   : optimal 2/(1+sin(pi h))\n");
+    else if (param->omega_mode == 2)
+      fprintf(stderr, "Over-relaxation   : adapted to the residual decay\n");
+    else
+      fprintf(stderr, "Over-relaxation   : omega %g\n", param->omega);
+  }
+  if (param->algorithm == 3)
+    fprintf(stderr, "Smoother          : %s\n",
+            param->mg_smoother ? "damped Jacobi" : "Red-Black Gauss-Seidel");
+  if (param->algorithm == 4)
+    fprintf(stderr, "Preconditioner    : %s, %s\n",
+            preconds[param->cg_precond],
+            param->cg_pipelined ? "pipelined, one nonblocking reduction" : "two reductions");
+  if (param->nested)
+    fprintf(stderr, "Initial guess     : interpolated from the previous resolution\n");
+  if (param->ckpt_file)
+    fprintf(stderr, "Checkpoint        : %s%s, every %d iterations\n", param->ckpt_file,
+            param->restart ? ", restarted" : "", param->ckpt_every);
+  if (param->dumpfile)
+    fprintf(stderr, "Field dump        : %s (MPI-IO)\n", param->dumpfile);
+  if (param->trace_file)
+    fprintf(stderr, "Trace             : %s, last %ld events per process\n",
+            param->trace_file, param->trace_events);
+  if (param->bench_trials > 1 || param->bench_warmup > 0 || param->bench_file)
+    fprintf(stderr, "Benchmark         : %d trial(s) after %d warm-up run(s)%s%s\n",
+            param->bench_trials, param->bench_warmup,
+            param->bench_file ? ", results in " : "", param->bench_file ? param->bench_file : "");
   fprintf(stderr, "Num. Heat sources : %u\n", param->numsrcs);
 
   for (i = 0; i < param->numsrcs; i++)
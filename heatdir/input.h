@@ -9,6 +9,9 @@
 
 #include "heat.h"
 
+extern const char *algorithm_names[];
+
+int read_options(int argc, char *argv[], algoparam_t *param);
 int read_input(FILE *infile, algoparam_t *param);
 void print_params(algoparam_t *param);
 
@@ -2,6 +2,7 @@
  * misc.c
  *
  * Helper functions for
+ * - process topology and domain decomposition
  * - initialization
  * - finalization,
  * - writing out a picture
@@ -11,12 +12,64 @@
 #include <stdio.h>
 #include <math.h>
 #include <float.h>
+#include <string.h>
 
 #include "heat.h"
 
+/*
+ * Create the 2D Cartesian process grid
+ * - dimensions not fixed on the command line (0) are chosen by MPI_Dims_create
+ * - neighbors are determined with MPI_Cart_shift
+ */
+int create_topology(algoparam_t *param)
+{
+	int periods[2] = {0, 0};
+	int rank, size;
+
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &size);
+
+	if (param->dims[0] < 0 || param->dims[1] < 0 ||
+		(param->dims[0] > 0 && param->dims[1] > 0 && param->dims[0] * param->dims[1] != size) ||
+		(param->dims[0] > 0 && size % param->dims[0] != 0) ||
+		(param->dims[1] > 0 && size % param->dims[1] != 0))
+	{
+		if (rank == 0)
+			fprintf(stderr, "Error: Process grid %dx%d does not match %d processes\n",
+					param->dims[0], param->dims[1], size);
+		return 0;
+	}
+
+	MPI_Dims_create(size, 2, param->dims);
+	MPI_Cart_create(MPI_COMM_WORLD, 2, param->dims, periods, 1, &param->comm);
+
+	MPI_Comm_rank(param->comm, &param->rank);
+	MPI_Comm_size(param->comm, &param->size);
+	MPI_Cart_coords(param->comm, param->rank, 2, param->coords);
+
+	// dimension 0 runs along y (rows), dimension 1 along x (columns)
+	MPI_Cart_shift(param->comm, 0, 1, &param->top_neighbor, &param->bottom_neighbor);
+	MPI_Cart_shift(param->comm, 1, 1, &param->left_neighbor, &param->right_neighbor);
+
+	return 1;
+}
+
+/*
+ * Split n points into parts blocks, the first n % parts blocks get
+ * one additional point. Returns start and length of block idx.
+ */
+void decompose(int n, int parts, int idx, int *start, int *count)
+{
+	int base = n / parts;
+	int extra = n % parts;
+
+	*count = base + (idx < extra ? 1 : 0);
+	*start = idx * base + (idx < extra ? idx : extra);
+}
+
 /*
  * Initialize the iterative solver
- * - allocate memory for matrices
+ * - place the matrices in the grid arena
  * - set boundary conditions according to configuration
  */
 int initialize(algoparam_t *param)
@@ -24,57 +77,73 @@ int initialize(algoparam_t *param)
 	int i, j;
 	double dist;
 
-	// determine local grid size and neighbors
-	int base_rows = param->act_res / param->size;
-	int extra_rows = param->act_res % param->size;
-	param->local_act_res = base_rows + (param->rank < extra_rows ? 1 : 0);
-	param->start_y = param->rank * base_rows + (param->rank < extra_rows ? param->rank : extra_rows);
-	param->top_neighbor = (param->rank > 0) ? param->rank - 1 : -1;
-	param->bottom_neighbor = (param->rank < param->size - 1) ? param->rank + 1 : -1;
-
-	// total number of points in x direction (including border)
-	const int sizex = param->act_res + 2;
-	// total number of points in y direction for local grid (including border)
-	const int sizey_local = param->local_act_res + 2;
-
-	//
-	// allocate memory
-	//
-	(param->u) = (double *)calloc(sizeof(double), sizex * sizey_local);
-	(param->uhelp) = (double *)calloc(sizeof(double), sizex * sizey_local);
-	if (param->rank == 0)
+	// determine local block size in both directions
+	decompose(param->act_res, param->dims[0], param->coords[0], &param->start_y, &param->local_rows);
+	decompose(param->act_res, param->dims[1], param->coords[1], &param->start_x, &param->local_cols);
+
+	// ghost layers on each side, the physical boundary is ghost layer h-1
+	const int h = param->halo;
+	const int g = h - 1;
+
+	// total number of points in x direction for local grid (including ghost layers)
+	const int sizex = param->local_cols + 2 * h;
+	// total number of points in y direction for local grid (including ghost layers)
+	const int sizey_local = param->local_rows + 2 * h;
+	// row stride of the grids, padded (see arena.c)
+	param->ld = arena_stride(sizex);
+	const int ld = param->ld;
+
+	// global row length, used to place the heat sources
+	const int np = param->act_res + 2;
+
+	// h interior columns of the local block for the halo exchange
+	MPI_Type_vector(param->local_rows, h, ld, MPI_DOUBLE, &param->column_t);
+	MPI_Type_commit(&param->column_t);
+
+	// the grids of the persistent arena, sized for max_res
+	param->u = param->arena.grid[0];
+	param->uhelp = param->arena.grid[1];
+
+	// cleared with the row schedule of the sweeps, the pages were placed
+	// by the first touch in arena_setup() with the rows of max_res
+#pragma omp parallel for private(j) schedule(static)
+	for (i = 0; i < sizey_local; i++)
 	{
-		(param->uvis) = (double *)calloc(sizeof(double),
-										 (param->visres + 2) *
-											 (param->visres + 2));
-		if (!(param->uvis))
+		for (j = 0; j < sizex; j++)
 		{
-			fprintf(stderr, "Error: Cannot allocate memory\n");
-			return 0;
+			param->u[i * ld + j] = 0.0;
+			param->uhelp[i * ld + j] = 0.0;
 		}
 	}
 
-	if (!(param->u) || !(param->uhelp))
-	{
-		fprintf(stderr, "Error: Cannot allocate memory\n");
-		return 0;
-	}
+	// deep halo sweeps are counted from the first exchange
+	param->sweep = 0;
+	param->redundant_points = 0.0;
+
+	// SOR factor of this resolution, h = 1 / (act_res + 1)
+	if (param->omega_mode == 1)
+		param->omega = 2.0 / (1.0 + sin(M_PI / (param->act_res + 1)));
+	else if (param->omega_mode == 2)
+		param->omega = 1.0;
+	param->omega_iter = 0;
 
 	for (i = 0; i < param->numsrcs; i++)
 	{
-		/* top row (handled by rank 0) */
-		if (param->rank == 0)
+		/* top row (handled by the first process row) */
+		if (param->coords[0] == 0)
 		{
 			for (j = 0; j < sizex; j++)
 			{
-				dist = sqrt(pow((double)j / (double)(sizex - 1) -
+				if (param->start_x + j - g < 0 || param->start_x + j - g > np - 1)
+					continue;
+				dist = sqrt(pow((double)(param->start_x + j - g) / (double)(np - 1) -
 									param->heatsrcs[i].posx,
 								2) +
 							pow(param->heatsrcs[i].posy, 2));
 
 				if (dist <= param->heatsrcs[i].range)
 				{
-					(param->u)[j] +=
+					(param->u)[g * ld + j] +=
 						(param->heatsrcs[i].range - dist) /
 						param->heatsrcs[i].range *
 						param->heatsrcs[i].temp;
@@ -82,19 +151,21 @@ int initialize(algoparam_t *param)
 			}
 		}
 
-		/* bottom row (handled by last rank) */
-		if (param->rank == param->size - 1)
+		/* bottom row (handled by the last process row) */
+		if (param->coords[0] == param->dims[0] - 1)
 		{
 			for (j = 0; j < sizex; j++)
 			{
-				dist = sqrt(pow((double)j / (double)(sizex - 1) -
+				if (param->start_x + j - g < 0 || param->start_x + j - g > np - 1)
+					continue;
+				dist = sqrt(pow((double)(param->start_x + j - g) / (double)(np - 1) -
 									param->heatsrcs[i].posx,
 								2) +
 							pow(1 - param->heatsrcs[i].posy, 2));
 
 				if (dist <= param->heatsrcs[i].range)
 				{
-					(param->u)[(sizey_local - 1) * sizex + j] +=
+					(param->u)[(sizey_local - h) * ld + j] +=
 						(param->heatsrcs[i].range - dist) /
 						param->heatsrcs[i].range *
 						param->heatsrcs[i].temp;
@@ -102,10 +173,13 @@ int initialize(algoparam_t *param)
 			}
 		}
 
-		/* leftmost column */
-		for (j = 1; j < sizey_local - 1; j++)
+		/* leftmost column (handled by the first process column),
+		   including the ghost rows so both grids carry it into the deep halo */
+		for (j = 0; j < sizey_local && param->coords[1] == 0; j++)
 		{
-			double global_y = (double)(param->start_y + j - 1) / (double)(param->act_res);
+			if (param->start_y + j - h < 0 || param->start_y + j - h >= (int)param->act_res)
+				continue;
+			double global_y = (double)(param->start_y + j - h) / (double)(param->act_res);
 			dist = sqrt(pow(param->heatsrcs[i].posx, 2) +
 						pow(global_y -
 								param->heatsrcs[i].posy,
@@ -113,17 +187,19 @@ int initialize(algoparam_t *param)
 
 			if (dist <= param->heatsrcs[i].range)
 			{
-				(param->u)[j * sizex] +=
+				(param->u)[j * ld + g] +=
 					(param->heatsrcs[i].range - dist) /
 					param->heatsrcs[i].range *
 					param->heatsrcs[i].temp;
 			}
 		}
 
-		/* rightmost column */
-		for (j = 1; j < sizey_local - 1; j++)
+		/* rightmost column (handled by the last process column) */
+		for (j = 0; j < sizey_local && param->coords[1] == param->dims[1] - 1; j++)
 		{
-			double global_y = (double)(param->start_y + j - 1) / (double)(param->act_res);
+			if (param->start_y + j - h < 0 || param->start_y + j - h >= (int)param->act_res)
+				continue;
+			double global_y = (double)(param->start_y + j - h) / (double)(param->act_res);
 			dist = sqrt(pow(1 - param->heatsrcs[i].posx, 2) +
 						pow(global_y -
 								param->heatsrcs[i].posy,
@@ -131,7 +207,7 @@ int initialize(algoparam_t *param)
 
 			if (dist <= param->heatsrcs[i].range)
 			{
-				(param->u)[j * sizex + (sizex - 1)] +=
+				(param->u)[j * ld + (sizex - h)] +=
 					(param->heatsrcs[i].range - dist) /
 					param->heatsrcs[i].range *
 					param->heatsrcs[i].temp;
@@ -140,11 +216,32 @@ int initialize(algoparam_t *param)
 	}
 
 	// copy boundary conditions to uhelp
-	for (i = 0; i < sizex * sizey_local; i++)
+	for (i = 0; i < ld * sizey_local; i++)
 	{
 		param->uhelp[i] = param->u[i];
 	}
 
+	// float copies of the grids for the mixed-precision mode
+	if (param->precision > 0 && !mixed_setup(param))
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
+
+	// level hierarchy of the multigrid solver
+	if (param->algorithm == 3 && !mg_setup(param))
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
+
+	// work vectors of the conjugate gradient solver
+	if (param->algorithm == 4 && !cg_setup(param))
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
+
 	return 1;
 }
 
@@ -153,30 +250,30 @@ int initialize(algoparam_t *param)
  */
 int finalize(algoparam_t *param)
 {
-	if (param->u)
-	{
-		free(param->u);
-		param->u = 0;
-	}
+	// u and uhelp stay in the arena for the next resolution
+	param->u = 0;
+	param->uhelp = 0;
 
-	if (param->uhelp)
-	{
-		free(param->uhelp);
-		param->uhelp = 0;
-	}
+	mg_free(param);
+	mixed_free(param);
+	cg_free(param);
+
+	if (param->column_t != MPI_DATATYPE_NULL)
+		MPI_Type_free(&param->column_t);
 
 	return 1;
 }
 
 /*
  * write the given temperature u matrix to rgb values
- * and write the resulting image to file f
+ * and write the resulting image to file f (binary PPM)
  */
 void write_image(FILE *f, double *u,
 				 unsigned sizex, unsigned sizey)
 {
 	// RGB table
 	unsigned char r[1024], g[1024], b[1024];
+	unsigned char *rgb;
 	int i, j, k;
 
 	double min, max;
@@ -217,9 +314,10 @@ void write_image(FILE *f, double *u,
 	max = -DBL_MAX;
 
 	// find minimum and maximum
-	for (i = 0; i < sizey; i++)
+#pragma omp parallel for private(j) reduction(min : min) reduction(max : max) schedule(static)
+	for (i = 0; i < (int)sizey; i++)
 	{
-		for (j = 0; j < sizex; j++)
+		for (j = 0; j < (int)sizex; j++)
 		{
 			if (u[i * sizex + j] > max)
 				max = u[i * sizex + j];
@@ -228,54 +326,375 @@ void write_image(FILE *f, double *u,
 		}
 	}
 
-	fprintf(f, "P3\n");
-	fprintf(f, "%u %u\n", sizex, sizey);
-	fprintf(f, "%u\n", 255);
+	rgb = (unsigned char *)malloc((size_t)3 * sizex * sizey);
+	if (!rgb)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return;
+	}
 
-	for (i = 0; i < sizey; i++)
+	// map the temperatures to colors
+#pragma omp parallel for private(j, k) schedule(static)
+	for (i = 0; i < (int)sizey; i++)
 	{
-		for (j = 0; j < sizex; j++)
+		unsigned char *row = rgb + (size_t)3 * i * sizex;
+
+		for (j = 0; j < (int)sizex; j++)
 		{
 			k = (int)(1024.0 * (u[i * sizex + j] - min) / (max - min));
 			if (k == 1024)
 				k = 1023;
 
-			fprintf(f, "%d %d %d  ", r[k], g[k], b[k]);
+			row[3 * j] = r[k];
+			row[3 * j + 1] = g[k];
+			row[3 * j + 2] = b[k];
+		}
+	}
+
+	// binary PPM, written at once
+	fprintf(f, "P6\n");
+	fprintf(f, "%u %u\n", sizex, sizey);
+	fprintf(f, "%u\n", 255);
+	fwrite(rgb, 3 * sizex, sizey, f);
+
+	free(rgb);
+}
+
+/*
+ * write the given temperature u matrix as raw float field to file f
+ * (grayscale PFM: rows from bottom to top, the negative scale marks
+ * little endian data)
+ */
+void write_field(FILE *f, double *u,
+				 unsigned sizex, unsigned sizey)
+{
+	float *v;
+	int i, j;
+
+	v = (float *)malloc(sizeof(float) * sizex * sizey);
+	if (!v)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return;
+	}
+
+#pragma omp parallel for private(j) schedule(static)
+	for (i = 0; i < (int)sizey; i++)
+		for (j = 0; j < (int)sizex; j++)
+			v[(sizey - 1 - i) * sizex + j] = (float)u[i * sizex + j];
+
+	fprintf(f, "Pf\n%u %u\n-1.0\n", sizex, sizey);
+	fwrite(v, sizeof(float) * sizex, sizey, f);
+
+	free(v);
+}
+
+/*
+ * Box filter: coarse point (i, j) of unew is the sum of the fine points
+ * (y, x) with y / step = first_row + i and x / step = first_col + j that
+ * lie in the owned range [lo_y, hi_y) x [lo_x, hi_x). (start_y, start_x)
+ * is the global position of the local point (0, 0) including ghost cells.
+ */
+int coarsen(double *uold, unsigned oldx,
+			double *unew, unsigned newx,
+			int first_row, int rows, int first_col, int cols,
+			int lo_y, int hi_y, int lo_x, int hi_x,
+			int start_y, int start_x, int step)
+{
+	int i, j, y, x, y0, y1, x0, x1;
+	double sum;
+
+#pragma omp parallel for private(j, y, x, y0, y1, x0, x1, sum) schedule(static)
+	for (i = 0; i < rows; i++)
+	{
+		double *crow = unew + i * newx;
+
+		y0 = (first_row + i) * step;
+		y1 = y0 + step < hi_y ? y0 + step : hi_y;
+		if (y0 < lo_y)
+			y0 = lo_y;
+
+		for (j = 0; j < cols; j++)
+			crow[j] = 0.0;
+
+		// contiguous runs of step points per coarse column
+		for (y = y0; y < y1; y++)
+		{
+			const double *frow = uold + (y - start_y) * oldx;
+
+			for (j = 0; j < cols; j++)
+			{
+				x0 = (first_col + j) * step;
+				x1 = x0 + step < hi_x ? x0 + step : hi_x;
+				if (x0 < lo_x)
+					x0 = lo_x;
+
+				sum = 0.0;
+				for (x = x0 - start_x; x < x1 - start_x; x++)
+					sum += frow[x];
+				crow[j] += sum;
+			}
 		}
-		fprintf(f, "\n");
 	}
+	return 1;
+}
+
+/*
+ * Coarse indices k of the boxes [k * step, (k + 1) * step) that
+ * intersect [lo, hi), with k < max
+ */
+static void box_range(int lo, int hi, int step, int max, int *first, int *count)
+{
+	int last = (hi + step - 1) / step;
+
+	*first = lo / step;
+	if (last > max)
+		last = max;
+	*count = (last > *first) ? last - *first : 0;
 }
 
-int coarsen(double *uold, unsigned oldx, unsigned oldy,
-			double *unew, unsigned newx, unsigned newy, int start_y, int local_act_res, int stepy)
+/*
+ * Owned global rows/columns of a process at resolution res: interior
+ * plus physical boundary at the edge of the process grid
+ */
+void owned_range(algoparam_t *param, int res, int coords[2], int *lo_y, int *hi_y, int *lo_x, int *hi_x)
+{
+	int start_y, start_x, rows, cols;
+
+	decompose(res, param->dims[0], coords[0], &start_y, &rows);
+	decompose(res, param->dims[1], coords[1], &start_x, &cols);
+
+	*lo_y = start_y + (coords[0] == 0 ? 0 : 1);
+	*hi_y = start_y + rows + 1 + (coords[0] == param->dims[0] - 1 ? 1 : 0);
+	*lo_x = start_x + (coords[1] == 0 ? 0 : 1);
+	*hi_x = start_x + cols + 1 + (coords[1] == param->dims[1] - 1 ? 1 : 0);
+}
+
+/*
+ * Copy the owned points of the current iterate into buf (to = 0) or
+ * from buf into both grids (to = 1)
+ */
+void copy_owned(algoparam_t *param, double *buf, int to)
 {
-	int global_row, j, local_row, local_coarse_row;
+	const int ld = param->ld;
+	const int g = param->halo - 1;
+	int lo_y, hi_y, lo_x, hi_x, i, j, k;
 
-	int stepx;
-	int stopx = newx;
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
 
-	if (oldx > newx)
-		stepx = oldx / newx;
-	else
+#pragma omp parallel for private(j, k) schedule(static)
+	for (i = lo_y; i < hi_y; i++)
 	{
-		stepx = 1;
-		stopx = oldx;
+		for (j = lo_x; j < hi_x; j++)
+		{
+			const int b = (i - lo_y) * (hi_x - lo_x) + j - lo_x;
+			k = (i - param->start_y + g) * ld + j - param->start_x + g;
+
+			if (to && param->uf)
+				param->uf[k] = param->uhelpf[k] = (float)buf[b];
+			else if (to)
+				param->u[k] = param->uhelp[k] = buf[b];
+			else
+				buf[b] = param->uf ? param->uf[k] : param->u[k];
+		}
 	}
+}
 
-	// NOTE: this only takes the top-left corner,
-	// and doesnt' do any real coarsening
-	local_coarse_row = 0;
-	// loop through global rows at global coarsening steps
-	for (global_row = start_y; global_row < start_y + local_act_res; global_row += stepy)
+/*
+ * Coarsen the local blocks of param->u in parallel and start gathering
+ * the result on rank 0.
+ *
+ * Every process box-filters the global points it owns into the coarse
+ * points whose boxes intersect its block; a box on a process boundary
+ * gets partial sums from each process. Rank 0 computes the coarse block
+ * of every process from the decomposition, so the blocks are collected
+ * with a single MPI_Igatherv that runs while the caller goes on.
+ * gather_image_end() completes the gather into param->uvis.
+ */
+int gather_image_begin(algoparam_t *param, gather_t *gather)
+{
+	const int np = param->act_res + 2;
+	const int g = param->halo - 1;
+	int step, lo_y, hi_y, lo_x, hi_x, r, vis;
+	int block[4]; // first coarse row, rows, first coarse column, columns
+
+	step = (np > param->visres + 2) ? np / (param->visres + 2) : 1;
+	vis = (np + step - 1) / step;
+	if (vis > param->visres + 2)
+		vis = param->visres + 2;
+
+	gather->step = step;
+	gather->visx = gather->visy = vis;
+	gather->blocks = gather->counts = gather->displs = NULL;
+	gather->staging = NULL;
+
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
+	box_range(lo_y, hi_y, step, vis, &block[0], &block[1]);
+	box_range(lo_x, hi_x, step, vis, &block[2], &block[3]);
+
+	gather->local = (double *)malloc(sizeof(double) * (block[1] * block[3] + 1));
+	if (!gather->local)
 	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
 
-		local_row = global_row - start_y;
+	coarsen(param->u, param->ld, gather->local, block[3],
+			block[0], block[1], block[2], block[3],
+			lo_y, hi_y, lo_x, hi_x,
+			param->start_y - g, param->start_x - g, step);
 
-		for (j = 0; j < stopx - 1; j++)
+	// coarse blocks, counts and displacements of all processes
+	if (param->rank == 0)
+	{
+		int offset = 0, coords[2];
+
+		gather->blocks = (int *)malloc(sizeof(int) * 4 * param->size);
+		gather->counts = (int *)malloc(sizeof(int) * param->size);
+		gather->displs = (int *)malloc(sizeof(int) * param->size);
+
+		for (r = 0; r < param->size; r++)
 		{
-			unew[local_coarse_row * newx + j] = uold[local_row * oldx + j * stepx];
+			int *b = &gather->blocks[4 * r];
+
+			MPI_Cart_coords(param->comm, r, 2, coords);
+			owned_range(param, param->act_res, coords, &lo_y, &hi_y, &lo_x, &hi_x);
+			box_range(lo_y, hi_y, step, vis, &b[0], &b[1]);
+			box_range(lo_x, hi_x, step, vis, &b[2], &b[3]);
+
+			gather->counts[r] = b[1] * b[3];
+			gather->displs[r] = offset;
+			offset += gather->counts[r];
 		}
-		local_coarse_row++;
+		gather->staging = (double *)malloc(sizeof(double) * (offset + 1));
 	}
+
+	MPI_Igatherv(gather->local, block[1] * block[3], MPI_DOUBLE,
+				 gather->staging, gather->counts, gather->displs, MPI_DOUBLE, 0,
+				 param->comm, &gather->req);
+
+	return 1;
+}
+
+/*
+ * Complete the gather of gather_image_begin(): rank 0 adds up the
+ * partial boxes and divides by the number of points of every box.
+ * The size of the coarse image is returned in visx, visy.
+ */
+void gather_image_end(algoparam_t *param, gather_t *gather, unsigned *visx, unsigned *visy)
+{
+	const int np = param->act_res + 2;
+	const int vis = gather->visx;
+	const int step = gather->step;
+	int r, i, j;
+
+	MPI_Wait(&gather->req, MPI_STATUS_IGNORE);
+
+	*visx = gather->visx;
+	*visy = gather->visy;
+
+	if (param->rank == 0)
+	{
+		memset(param->uvis, 0, sizeof(double) * vis * vis);
+
+		for (r = 0; r < param->size; r++)
+		{
+			int *b = &gather->blocks[4 * r];
+			const double *src = &gather->staging[gather->displs[r]];
+
+			for (i = 0; i < b[1]; i++)
+				for (j = 0; j < b[3]; j++)
+					param->uvis[(b[0] + i) * vis + b[2] + j] += src[i * b[3] + j];
+		}
+
+		// boxes of the last coarse row/column are cut off at np
+#pragma omp parallel for private(j) schedule(static)
+		for (i = 0; i < vis; i++)
+		{
+			const int ny = (i + 1) * step < np ? step : np - i * step;
+
+			for (j = 0; j < vis; j++)
+			{
+				const int nx = (j + 1) * step < np ? step : np - j * step;
+				param->uvis[i * vis + j] /= (double)(ny * nx);
+			}
+		}
+
+		free(gather->staging);
+		free(gather->blocks);
+		free(gather->counts);
+		free(gather->displs);
+	}
+
+	free(gather->local);
+}
+
+/*
+ * Write the full resolution temperature field of all processes into
+ * one file with collective MPI-IO (grayscale PFM, see write_field())
+ *
+ * Every process writes the points it owns, as in gather_image_begin(), through
+ * a subarray file view, so the file is assembled by the MPI-IO layer
+ * instead of rank 0.
+ */
+int dump_field(algoparam_t *param, const char *filename)
+{
+	const int np = param->act_res + 2;
+	const int ld = param->ld;
+	const int g = param->halo - 1;
+	int sizes[2], subsizes[2], starts[2];
+	int lo_y, hi_y, lo_x, hi_x, i, j, len, err;
+	char header[64];
+	float *v;
+	MPI_Datatype filetype;
+	MPI_File fh;
+
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
+
+	v = (float *)malloc(sizeof(float) * (hi_y - lo_y) * (hi_x - lo_x));
+	if (!v)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
+
+	// rows from bottom to top, global point (y, x) is local (y - start_y + g, x - start_x + g)
+#pragma omp parallel for private(j) schedule(static)
+	for (i = lo_y; i < hi_y; i++)
+		for (j = lo_x; j < hi_x; j++)
+			v[(hi_y - 1 - i) * (hi_x - lo_x) + j - lo_x] =
+				(float)param->u[(i - param->start_y + g) * ld + j - param->start_x + g];
+
+	sizes[0] = sizes[1] = np;
+	subsizes[0] = hi_y - lo_y;
+	subsizes[1] = hi_x - lo_x;
+	starts[0] = np - hi_y;
+	starts[1] = lo_x;
+	MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_FLOAT, &filetype);
+	MPI_Type_commit(&filetype);
+
+	len = snprintf(header, sizeof(header), "Pf\n%d %d\n-1.0\n", np, np);
+
+	err = MPI_File_open(param->comm, filename, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+	if (err == MPI_SUCCESS)
+	{
+		MPI_File_set_size(fh, 0);
+		if (param->rank == 0)
+			MPI_File_write_at(fh, 0, header, len, MPI_CHAR, MPI_STATUS_IGNORE);
+		MPI_File_set_view(fh, len, MPI_FLOAT, filetype, "native", MPI_INFO_NULL);
+		err = MPI_File_write_all(fh, v, subsizes[0] * subsizes[1], MPI_FLOAT, MPI_STATUS_IGNORE);
+		MPI_File_close(&fh);
+	}
+
+	MPI_Type_free(&filetype);
+	free(v);
+
+	if (err != MPI_SUCCESS)
+	{
+		if (param->rank == 0)
+			fprintf(stderr, "Error: Cannot write \"%s\"\n", filename);
+		return 0;
+	}
+
 	return 1;
 }
@@ -0,0 +1,160 @@
+/*
+ * mixed.c
+ *
+ * Mixed-precision Jacobi
+ *
+ * u and uhelp are stored as float, which halves the bytes per point of
+ * the bandwidth-bound sweep, while the stencil and the residual are
+ * accumulated in double. Near the threshold the rounding of the stored
+ * values limits the residual, so with iterative refinement (precision 2)
+ * the grids are converted back to double once the residual gets close to
+ * the threshold or stops decreasing, and the regular double sweep
+ * finishes the solve.
+ *
+ * The double grids stay resident in the arena while the float grids are
+ * in use, so switching back does not fault in pages inside the timed
+ * loop. The grids thus take 1.5 times the memory of the double grids.
+ */
+
+#include "heat.h"
+#include <mpi.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// switch to double once the residual is below MIXED_REFINE x threshold
+#define MIXED_REFINE 10.0
+
+/*
+ * Allocate a grid of sizey rows ld points apart, first touched with the
+ * row schedule of the sweeps
+ */
+static float *alloc_float(int ld, int sizey)
+{
+	float *v = (float *)malloc(sizeof(float) * ld * sizey);
+	int i, j;
+
+	if (!v)
+		return 0;
+
+#pragma omp parallel for private(j) schedule(static)
+	for (i = 0; i < sizey; i++)
+		for (j = 0; j < ld; j++)
+			v[i * ld + j] = 0.0f;
+
+	return v;
+}
+
+/*
+ * Replace the double grids of initialize() by float copies
+ */
+int mixed_setup(algoparam_t *param)
+{
+	const int ld = param->ld;
+	const int sizey = param->local_rows + 2;
+	int i;
+
+	// same row stride as the double grids, so copy_owned() serves both
+	param->uf = alloc_float(ld, sizey);
+	param->uhelpf = alloc_float(ld, sizey);
+	if (!param->uf || !param->uhelpf)
+		return 0;
+
+	for (i = 0; i < ld * sizey; i++)
+	{
+		param->uf[i] = (float)param->u[i];
+		param->uhelpf[i] = (float)param->uhelp[i];
+	}
+
+	// the double grids stay in the arena until mixed_to_double()
+	param->u = param->uhelp = 0;
+
+	MPI_Type_vector(param->local_rows, 1, ld, MPI_FLOAT, &param->column_float_t);
+	MPI_Type_commit(&param->column_float_t);
+
+	param->prev_residual = -1.0;
+
+	return 1;
+}
+
+/*
+ * Continue in double precision, no-op if the grids are double already
+ */
+void mixed_to_double(algoparam_t *param)
+{
+	const int sizex = param->local_cols + 2;
+	const int sizey = param->local_rows + 2;
+	const int ld = param->ld;
+	int i, j;
+
+	if (!param->uf)
+		return;
+
+	param->u = param->arena.grid[0];
+	param->uhelp = param->arena.grid[1];
+
+	// with the row schedule of the sweeps
+#pragma omp parallel for private(j) schedule(static)
+	for (i = 0; i < sizey; i++)
+	{
+		for (j = 0; j < sizex; j++)
+		{
+			param->u[i * ld + j] = param->uf[i * ld + j];
+			param->uhelp[i * ld + j] = param->uhelpf[i * ld + j];
+		}
+	}
+
+	free(param->uf);
+	free(param->uhelpf);
+	param->uf = param->uhelpf = 0;
+}
+
+/*
+ * Called with every global residual: refine in double once the residual
+ * is close to the threshold or no longer decreases in float
+ */
+void mixed_check(algoparam_t *param, double residual, double threshold)
+{
+	if (param->precision != 2 || !param->uf)
+		return;
+
+	if (residual < MIXED_REFINE * threshold ||
+		(param->prev_residual >= 0.0 && residual >= param->prev_residual))
+		mixed_to_double(param);
+
+	param->prev_residual = residual;
+}
+
+void mixed_free(algoparam_t *param)
+{
+	if (param->uf)
+	{
+		free(param->uf);
+		free(param->uhelpf);
+		param->uf = param->uhelpf = 0;
+	}
+
+	if (param->column_float_t != MPI_DATATYPE_NULL)
+		MPI_Type_free(&param->column_float_t);
+}
+
+/*
+ * Combined Jacobi iteration and residual calculation on float grids,
+ * single ghost layer and blocking halo exchange
+ *
+ * Flop count in inner body is 7
+ */
+double relax_jacobi_residual_float(float *restrict u, float *restrict utmp, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	const unsigned ld = param->ld;
+	int i;
+	double sum = 0.0;
+
+	exchange_halo_float(u, sizex, sizey, param);
+
+#pragma omp parallel for reduction(+ : sum) schedule(static)
+	for (i = 1; i < (int)sizey - 1; i++)
+		sum += jacobi_residual_row_float(u + i * ld, utmp + i * ld, ld, 1, sizex - 1);
+
+	return sum;
+}
@@ -0,0 +1,643 @@
+/*
+ * multigrid.c
+ *
+ * Geometric multigrid (V-cycle) solver
+ *
+ * The fine level is the distributed grid set up by initialize(). Coarse
+ * levels keep every other point of the next finer level in each direction
+ * and are distributed like the fine level: a rank owns the coarse points
+ * that lie in its fine block. Once a coarse level would leave a rank with
+ * fewer than MG_MIN_LOCAL rows or columns, the level is gathered onto
+ * rank 0 and coarsened further there.
+ *
+ * All levels solve  diag * u - sum(c * neighbor) = b  with the 5-point
+ * finite difference Laplacian in units of the fine mesh width. On the fine
+ * level all weights are 1 and b = 0, i.e. the Jacobi equation. When the
+ * number of points is even, the last interval of the coarse grid is shorter
+ * than the others, so coarse levels carry per-index stencil weights.
+ */
+
+#include "heat.h"
+#include "timing.h"
+#include <mpi.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define MG_PRE 2		 // pre-smoothing sweeps
+#define MG_POST 2		 // post-smoothing sweeps
+#define MG_COARSEST 3	 // stop coarsening at this many interior points
+#define MG_MIN_LOCAL 2	 // minimum local rows/columns of a distributed level
+#define MG_OMEGA 0.8	 // damping of the Jacobi smoother
+
+/*
+ * Local geometry of a level (the fine level uses param itself)
+ */
+static algoparam_t *level_param(algoparam_t *param, mglevel_t *lv)
+{
+	return (lv == param->mg_levels) ? param : &lv->p;
+}
+
+/*
+ * Interior points of the block owned on the coarse level, given the
+ * owned points [start + 1, start + count] of the finer level
+ */
+static void coarse_range(int start, int count, int *cstart, int *ccount)
+{
+	int first = (start + 2) / 2;	   // ceil((start + 1) / 2)
+	int last = (start + count) / 2;
+
+	*cstart = first - 1;
+	*ccount = last - first + 1;
+}
+
+/*
+ * Stencil weights and interpolation weights of a level from the
+ * coordinates x[0..n+1] of its points
+ */
+static void level_weights(mglevel_t *lv)
+{
+	int k;
+	double hw, he;
+
+	for (k = 1; k <= lv->n; k++)
+	{
+		hw = lv->x[k] - lv->x[k - 1];
+		he = lv->x[k + 1] - lv->x[k];
+		lv->cw[k] = 2.0 / (hw * (hw + he));
+		lv->ce[k] = 2.0 / (he * (hw + he));
+
+		// weight of the lower coarse neighbor when interpolating odd points
+		lv->wl[k] = he / (hw + he);
+	}
+}
+
+static int alloc_level(mglevel_t *lv)
+{
+	lv->x = (double *)calloc(sizeof(double), lv->n + 2);
+	lv->cw = (double *)calloc(sizeof(double), lv->n + 2);
+	lv->ce = (double *)calloc(sizeof(double), lv->n + 2);
+	lv->wl = (double *)calloc(sizeof(double), lv->n + 2);
+
+	return lv->x && lv->cw && lv->ce && lv->wl;
+}
+
+static int alloc_grids(mglevel_t *lv, int fine)
+{
+	const int ld = lv->p.ld;
+	const int sizey = lv->p.local_rows + 2;
+
+	lv->r = (double *)calloc(sizeof(double), ld * sizey);
+	if (fine)
+		return lv->r != 0;
+
+	lv->u = (double *)calloc(sizeof(double), ld * sizey);
+	lv->b = (double *)calloc(sizeof(double), ld * sizey);
+	lv->tmp = (double *)calloc(sizeof(double), ld * sizey);
+
+	MPI_Type_vector(lv->p.local_rows, 1, ld, MPI_DOUBLE, &lv->p.column_t);
+	MPI_Type_commit(&lv->p.column_t);
+
+	return lv->r && lv->u && lv->b && lv->tmp;
+}
+
+/*
+ * Set up the level hierarchy for the current resolution
+ */
+int mg_setup(algoparam_t *param)
+{
+	int l, k, nlevels, min_local[2], local[2];
+	mglevel_t *levels, *lv, *fine;
+
+	// number of levels: halving down to MG_COARSEST plus one gathered copy
+	nlevels = 2;
+	for (k = param->act_res; k > MG_COARSEST; k /= 2)
+		nlevels++;
+
+	levels = (mglevel_t *)calloc(sizeof(mglevel_t), nlevels);
+	if (!levels)
+		return 0;
+	param->mg_levels = levels;
+
+	// fine level: the grid of initialize()
+	lv = &levels[0];
+	lv->n = param->act_res;
+	lv->active = 1;
+	lv->p = *param;
+	lv->p.omega = 1.0; // the smoother is plain Gauss-Seidel
+	if (!alloc_level(lv) || !alloc_grids(lv, 1))
+		return 0;
+	for (k = 0; k <= lv->n + 1; k++)
+		lv->x[k] = k;
+	level_weights(lv);
+	lv->u = param->u;
+
+	l = 0;
+	while (levels[l].n > MG_COARSEST)
+	{
+		fine = &levels[l];
+		lv = &levels[l + 1];
+		lv->p = fine->p;
+		lv->p.halo = 1;
+
+		if (!fine->serial && param->size > 1)
+		{
+			// would the coarse level still give every rank enough points ?
+			coarse_range(fine->p.start_y, fine->p.local_rows, &lv->p.start_y, &local[0]);
+			coarse_range(fine->p.start_x, fine->p.local_cols, &lv->p.start_x, &local[1]);
+			MPI_Allreduce(local, min_local, 2, MPI_INT, MPI_MIN, param->comm);
+
+			if (min_local[0] < MG_MIN_LOCAL || min_local[1] < MG_MIN_LOCAL)
+			{
+				// gathered copy of the fine level on rank 0
+				lv->n = fine->n;
+				lv->serial = 1;
+				lv->active = (param->rank == 0);
+				lv->p.start_y = lv->p.start_x = 0;
+				lv->p.local_rows = lv->p.local_cols = lv->n;
+				lv->p.ld = lv->n + 2;
+				lv->p.top_neighbor = lv->p.bottom_neighbor = MPI_PROC_NULL;
+				lv->p.left_neighbor = lv->p.right_neighbor = MPI_PROC_NULL;
+				if (!alloc_level(lv))
+					return 0;
+				memcpy(lv->x, fine->x, sizeof(double) * (lv->n + 2));
+				level_weights(lv);
+				if (lv->active && !alloc_grids(lv, 0))
+					return 0;
+				l++;
+				continue;
+			}
+		}
+
+		// coarse level: every other point, the boundary stays in place
+		lv->n = fine->n / 2;
+		lv->serial = fine->serial;
+		lv->active = fine->active;
+		coarse_range(fine->p.start_y, fine->p.local_rows, &lv->p.start_y, &lv->p.local_rows);
+		coarse_range(fine->p.start_x, fine->p.local_cols, &lv->p.start_x, &lv->p.local_cols);
+		lv->p.ld = lv->p.local_cols + 2; // the coarse grids are not padded
+		if (!alloc_level(lv))
+			return 0;
+		for (k = 0; k <= lv->n; k++)
+			lv->x[k] = fine->x[2 * k];
+		lv->x[lv->n + 1] = fine->x[fine->n + 1];
+		level_weights(lv);
+		if (lv->active && !alloc_grids(lv, 0))
+			return 0;
+		l++;
+	}
+	param->mg_nlevels = l + 1;
+
+	return 1;
+}
+
+void mg_free(algoparam_t *param)
+{
+	int l;
+	mglevel_t *lv;
+
+	if (!param->mg_levels)
+		return;
+
+	for (l = 0; l < param->mg_nlevels; l++)
+	{
+		lv = &param->mg_levels[l];
+		free(lv->x);
+		free(lv->cw);
+		free(lv->ce);
+		free(lv->wl);
+		free(lv->r);
+		if (l > 0)
+		{
+			free(lv->u);
+			free(lv->b);
+			free(lv->tmp);
+			if (lv->active)
+				MPI_Type_free(&lv->p.column_t);
+		}
+	}
+
+	free(param->mg_levels);
+	param->mg_levels = 0;
+	param->mg_nlevels = 0;
+}
+
+/*
+ * Red-black Gauss-Seidel sweep with the stencil weights of the level,
+ * returns the squared update
+ */
+static double smooth_redblack(mglevel_t *lv, double *u, double *b)
+{
+	const int sizex = lv->p.local_cols + 2;
+	const int sizey = lv->p.local_rows + 2;
+	const int ld = lv->p.ld;
+	const int parity = (lv->p.start_y + lv->p.start_x) & 1;
+	int colour, i, j, gy, gx;
+	double unew, diff, sum = 0.0;
+
+	for (colour = 0; colour < 2; colour++)
+	{
+		exchange_halo(u, sizex, sizey, &lv->p);
+
+#pragma omp parallel for private(j, gy, gx, unew, diff) reduction(+ : sum)
+		for (i = 1; i < sizey - 1; i++)
+		{
+			gy = lv->p.start_y + i;
+			for (j = 1 + ((i + parity + colour + 1) & 1); j < sizex - 1; j += 2)
+			{
+				gx = lv->p.start_x + j;
+				unew = (b[i * ld + j] +
+						lv->cw[gx] * u[i * ld + (j - 1)] +
+						lv->ce[gx] * u[i * ld + (j + 1)] +
+						lv->cw[gy] * u[(i - 1) * ld + j] +
+						lv->ce[gy] * u[(i + 1) * ld + j]) /
+					   (lv->cw[gx] + lv->ce[gx] + lv->cw[gy] + lv->ce[gy]);
+				diff = unew - u[i * ld + j];
+				sum += diff * diff;
+				u[i * ld + j] = unew;
+			}
+		}
+	}
+
+	return sum;
+}
+
+/*
+ * Damped Jacobi sweep with the stencil weights of the level
+ */
+static double smooth_jacobi(mglevel_t *lv, double *u, double *b)
+{
+	const int sizex = lv->p.local_cols + 2;
+	const int sizey = lv->p.local_rows + 2;
+	const int ld = lv->p.ld;
+	int i, j, gy, gx;
+	double unew, diff, sum = 0.0;
+
+	exchange_halo(u, sizex, sizey, &lv->p);
+
+#pragma omp parallel for private(j, gy, gx, unew) reduction(+ : sum)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		gy = lv->p.start_y + i;
+		for (j = 1; j < sizex - 1; j++)
+		{
+			gx = lv->p.start_x + j;
+			unew = (b[i * ld + j] +
+					lv->cw[gx] * u[i * ld + (j - 1)] +
+					lv->ce[gx] * u[i * ld + (j + 1)] +
+					lv->cw[gy] * u[(i - 1) * ld + j] +
+					lv->ce[gy] * u[(i + 1) * ld + j]) /
+				   (lv->cw[gx] + lv->ce[gx] + lv->cw[gy] + lv->ce[gy]);
+			lv->tmp[i * ld + j] = unew;
+		}
+	}
+
+#pragma omp parallel for private(j, diff) reduction(+ : sum)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		for (j = 1; j < sizex - 1; j++)
+		{
+			diff = lv->tmp[i * ld + j] - u[i * ld + j];
+			sum += diff * diff;
+			u[i * ld + j] += MG_OMEGA * diff;
+		}
+	}
+
+	return sum;
+}
+
+/*
+ * One smoothing sweep, the fine level reuses the solver's own kernels
+ */
+static double smooth(algoparam_t *param, mglevel_t *lv)
+{
+	const int sizex = lv->p.local_cols + 2;
+	const int sizey = lv->p.local_rows + 2;
+	const int ld = lv->p.ld;
+	int i, j;
+	double diff, sum = 0.0;
+
+	if (lv != param->mg_levels)
+		return param->mg_smoother ? smooth_jacobi(lv, lv->u, lv->b) : smooth_redblack(lv, lv->u, lv->b);
+
+	if (!param->mg_smoother)
+	{
+		// with the omega of the level, -w is for the red-black solver
+		const double omega = param->omega;
+
+		param->omega = lv->p.omega;
+		sum = relax_redblack(param->u, sizex, sizey, param);
+		param->omega = omega;
+		return sum;
+	}
+
+	// damped Jacobi on the fine level: uhelp holds the undamped update
+	relax_jacobi(param->u, param->uhelp, sizex, sizey, param);
+
+#pragma omp parallel for private(j, diff) reduction(+ : sum)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		for (j = 1; j < sizex - 1; j++)
+		{
+			diff = param->uhelp[i * ld + j] - param->u[i * ld + j];
+			sum += diff * diff;
+			param->u[i * ld + j] += MG_OMEGA * diff;
+		}
+	}
+
+	return sum;
+}
+
+/*
+ * r = b - A u, including a halo exchange of r for the restriction
+ */
+static void residual(algoparam_t *param, mglevel_t *lv)
+{
+	const int sizex = lv->p.local_cols + 2;
+	const int sizey = lv->p.local_rows + 2;
+	const int ld = lv->p.ld;
+	double *u = lv->u;
+	int i, j, gy, gx;
+
+	exchange_halo(u, sizex, sizey, level_param(param, lv));
+
+#pragma omp parallel for private(j, gy, gx)
+	for (i = 1; i < sizey - 1; i++)
+	{
+		gy = lv->p.start_y + i;
+		for (j = 1; j < sizex - 1; j++)
+		{
+			gx = lv->p.start_x + j;
+			lv->r[i * ld + j] = (lv->b ? lv->b[i * ld + j] : 0.0) -
+								(lv->cw[gx] + lv->ce[gx] + lv->cw[gy] + lv->ce[gy]) * u[i * ld + j] +
+								lv->cw[gx] * u[i * ld + (j - 1)] +
+								lv->ce[gx] * u[i * ld + (j + 1)] +
+								lv->cw[gy] * u[(i - 1) * ld + j] +
+								lv->ce[gy] * u[(i + 1) * ld + j];
+		}
+	}
+
+	exchange_halo(lv->r, sizex, sizey, level_param(param, lv));
+}
+
+/*
+ * Restriction weights of fine point k for its coarse point K:
+ * the transpose of the linear interpolation
+ */
+static inline double restrict_weight(mglevel_t *fine, int k, int K)
+{
+	if (k == 2 * K)
+		return 1.0;
+	if (k < 1 || k > fine->n)
+		return 0.0;
+	return (k < 2 * K) ? 1.0 - fine->wl[k] : fine->wl[k];
+}
+
+/*
+ * b_coarse = restriction of r_fine (full weighting)
+ */
+static void restrict_residual(mglevel_t *fine, mglevel_t *coarse)
+{
+	const int fld = fine->p.ld;
+	const int csizex = coarse->p.local_cols + 2;
+	const int csizey = coarse->p.local_rows + 2;
+	const int cld = coarse->p.ld;
+	int I, J, K, L, di, dj, fi, fj;
+	double wy[3], wx[3], sy, sx, sum;
+
+#pragma omp parallel for private(J, K, L, di, dj, fi, fj, wy, wx, sy, sx, sum)
+	for (I = 1; I < csizey - 1; I++)
+	{
+		K = coarse->p.start_y + I;
+		sy = 0.0;
+		for (di = 0; di < 3; di++)
+			sy += (wy[di] = restrict_weight(fine, 2 * K - 1 + di, K));
+
+		for (J = 1; J < csizex - 1; J++)
+		{
+			L = coarse->p.start_x + J;
+			sx = 0.0;
+			for (dj = 0; dj < 3; dj++)
+				sx += (wx[dj] = restrict_weight(fine, 2 * L - 1 + dj, L));
+
+			sum = 0.0;
+			for (di = 0; di < 3; di++)
+			{
+				fi = 2 * K - 1 + di - fine->p.start_y;
+				for (dj = 0; dj < 3; dj++)
+				{
+					fj = 2 * L - 1 + dj - fine->p.start_x;
+					sum += wy[di] * wx[dj] * fine->r[fi * fld + fj];
+				}
+			}
+			coarse->b[I * cld + J] = sum / (sy * sx);
+			coarse->u[I * cld + J] = 0.0;
+		}
+	}
+}
+
+/*
+ * u_fine += linear interpolation of u_coarse
+ */
+static void prolongate(algoparam_t *param, mglevel_t *fine, mglevel_t *coarse)
+{
+	const int fsizex = fine->p.local_cols + 2;
+	const int fsizey = fine->p.local_rows + 2;
+	const int fld = fine->p.ld;
+	const int csizex = coarse->p.local_cols + 2;
+	const int cld = coarse->p.ld;
+	int i, j, k, m, K, M;
+	double wy0, wy1, wx0, wx1, *uc = coarse->u;
+
+	exchange_halo(uc, csizex, coarse->p.local_rows + 2, &coarse->p);
+
+#pragma omp parallel for private(j, k, m, K, M, wy0, wy1, wx0, wx1)
+	for (i = 1; i < fsizey - 1; i++)
+	{
+		k = fine->p.start_y + i;
+		K = k / 2 - coarse->p.start_y;
+		wy0 = (k & 1) ? fine->wl[k] : 1.0;
+		wy1 = (k & 1) ? 1.0 - fine->wl[k] : 0.0;
+
+		for (j = 1; j < fsizex - 1; j++)
+		{
+			m = fine->p.start_x + j;
+			M = m / 2 - coarse->p.start_x;
+			wx0 = (m & 1) ? fine->wl[m] : 1.0;
+			wx1 = (m & 1) ? 1.0 - fine->wl[m] : 0.0;
+
+			fine->u[i * fld + j] +=
+				wy0 * (wx0 * uc[K * cld + M] + wx1 * uc[K * cld + M + 1]) +
+				wy1 * (wx0 * uc[(K + 1) * cld + M] + wx1 * uc[(K + 1) * cld + M + 1]);
+		}
+	}
+}
+
+/*
+ * Gather the interior of a distributed level into the serial copy on rank 0
+ * (scatter = 0), or add the serial copy back into the distributed level
+ * (scatter = 1)
+ */
+static void transfer(algoparam_t *param, mglevel_t *dist, double *local, mglevel_t *serial, double *global, int scatter)
+{
+	const int ld = dist->p.ld;
+	const int gsizex = serial->n + 2;
+	int block[4] = {dist->p.start_y, dist->p.local_rows, dist->p.start_x, dist->p.local_cols};
+	int *blocks = NULL, *counts = NULL, *displs = NULL;
+	int r, i, n = block[1] * block[3];
+	double *buf, *staging = NULL, t0;
+
+	buf = (double *)malloc(sizeof(double) * (n + 1));
+
+	if (param->rank == 0)
+	{
+		blocks = (int *)malloc(sizeof(int) * 4 * param->size);
+		counts = (int *)malloc(sizeof(int) * param->size);
+		displs = (int *)malloc(sizeof(int) * param->size);
+	}
+	t0 = wtime();
+	MPI_Gather(block, 4, MPI_INT, blocks, 4, MPI_INT, 0, param->comm);
+	phase_add(PHASE_HALO, t0);
+
+	if (param->rank == 0)
+	{
+		int offset = 0;
+		for (r = 0; r < param->size; r++)
+		{
+			counts[r] = blocks[4 * r + 1] * blocks[4 * r + 3];
+			displs[r] = offset;
+			offset += counts[r];
+		}
+		staging = (double *)malloc(sizeof(double) * (offset + 1));
+	}
+
+	if (!scatter)
+	{
+		for (i = 0; i < block[1]; i++)
+			memcpy(&buf[i * block[3]], &local[(i + 1) * ld + 1], sizeof(double) * block[3]);
+
+		t0 = wtime();
+		MPI_Gatherv(buf, n, MPI_DOUBLE, staging, counts, displs, MPI_DOUBLE, 0, param->comm);
+		phase_add(PHASE_HALO, t0);
+
+		if (param->rank == 0)
+			for (r = 0; r < param->size; r++)
+				for (i = 0; i < blocks[4 * r + 1]; i++)
+					memcpy(&global[(blocks[4 * r] + i + 1) * gsizex + blocks[4 * r + 2] + 1],
+						   &staging[displs[r] + i * blocks[4 * r + 3]], sizeof(double) * blocks[4 * r + 3]);
+	}
+	else
+	{
+		if (param->rank == 0)
+			for (r = 0; r < param->size; r++)
+				for (i = 0; i < blocks[4 * r + 1]; i++)
+					memcpy(&staging[displs[r] + i * blocks[4 * r + 3]],
+						   &global[(blocks[4 * r] + i + 1) * gsizex + blocks[4 * r + 2] + 1], sizeof(double) * blocks[4 * r + 3]);
+
+		t0 = wtime();
+		MPI_Scatterv(staging, counts, displs, MPI_DOUBLE, buf, n, MPI_DOUBLE, 0, param->comm);
+		phase_add(PHASE_HALO, t0);
+
+		for (i = 0; i < block[1]; i++)
+		{
+			int j;
+			for (j = 0; j < block[3]; j++)
+				local[(i + 1) * ld + j + 1] += buf[i * block[3] + j];
+		}
+	}
+
+	free(buf);
+	if (param->rank == 0)
+	{
+		free(staging);
+		free(blocks);
+		free(counts);
+		free(displs);
+	}
+}
+
+/*
+ * One V-cycle starting at level l, returns the squared update of the
+ * last smoothing sweep on that level
+ */
+static double vcycle(algoparam_t *param, int l)
+{
+	mglevel_t *lv = &param->mg_levels[l];
+	mglevel_t *next = lv + 1;
+	double sum = 0.0;
+	int s;
+
+	if (!lv->active)
+		return 0.0;
+
+	if (l == param->mg_nlevels - 1)
+	{
+		// coarsest level: a few points, smooth until it is solved
+		for (s = 0; s < 50; s++)
+			sum = smooth(param, lv);
+		return sum;
+	}
+
+	for (s = 0; s < MG_PRE; s++)
+		smooth(param, lv);
+
+	residual(param, lv);
+
+	if (next->serial && !lv->serial)
+	{
+		// agglomerate: same grid, gathered onto rank 0
+		transfer(param, lv, lv->r, next, next->b, 0);
+		if (next->active)
+			memset(next->u, 0, sizeof(double) * (next->n + 2) * (next->n + 2));
+		vcycle(param, l + 1);
+		transfer(param, lv, lv->u, next, next->u, 1);
+	}
+	else
+	{
+		restrict_residual(lv, next);
+		vcycle(param, l + 1);
+		prolongate(param, lv, next);
+	}
+
+	for (s = 0; s < MG_POST; s++)
+		sum = smooth(param, lv);
+
+	return sum;
+}
+
+/*
+ * One multigrid iteration (V-cycle) on the fine grid param->u
+ *
+ * Returns the squared update of the last fine-level smoothing sweep,
+ * comparable to the residual of the other solvers.
+ */
+double relax_multigrid(algoparam_t *param)
+{
+	// the fine level works on the solver's grid
+	param->mg_levels[0].u = param->u;
+
+	return vcycle(param, 0);
+}
+
+/*
+ * Approximate flop count of one V-cycle per fine grid point:
+ * smoothing (7), residual (10), restriction and prolongation (~6),
+ * and 4/3 for the coarse levels
+ */
+double flops_multigrid(void)
+{
+	return 4.0 / 3.0 * ((MG_PRE + MG_POST) * 7.0 + 10.0 + 6.0);
+}
+
+/*
+ * Approximate main memory traffic of one V-cycle per fine grid point:
+ * smoothing (red-black: two passes reading and writing u, Jacobi: read u,
+ * write the copy), residual (read u and b, write r), restriction (read r)
+ * and prolongation (read and write u), 4/3 for the coarse levels
+ */
+double bytes_multigrid(algoparam_t *param)
+{
+	const double smooth = param->mg_smoother ? 24.0 : 32.0;
+
+	return 4.0 / 3.0 * ((MG_PRE + MG_POST) * smooth + 32.0 + 8.0 + 16.0);
+}
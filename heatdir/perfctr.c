@@ -0,0 +1,266 @@
+/*
+ * perfctr.c
+ *
+ * Hardware performance counters with perf_event_open
+ *
+ * Every thread of the process opens its own counters (pid 0 measures the
+ * calling thread), the master thread reads and sums them. Counted are
+ * cycles, instructions, last level cache misses and, on Intel, the
+ * retired double-precision FP instructions per vector width
+ * (FP_ARITH_INST_RETIRED, FMAs count twice), which give the executed
+ * Flops. The float sweep of the mixed-precision mode is not included.
+ * The events are opened separately, so the kernel multiplexes them if
+ * there are fewer counters than events; the counts are scaled by the
+ * time enabled/time running. Events that cannot be opened on all
+ * processes (no PMU in a VM, perf_event_paranoid, other CPU vendors)
+ * are reported as n/a. Only user space is counted.
+ *
+ * perf_begin()/perf_end() delimit the timed region of a resolution,
+ * perf_kernel_begin()/perf_kernel_end() the kernels in it. Every read
+ * costs one system call per event and thread, so the counters are only
+ * opened with --counters.
+ */
+
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "heat.h"
+
+const char *perf_kernel_names[PERF_KERNELS] = {"sweep", "residual"};
+
+// FP_ARITH_INST_RETIRED (event 0xc7) umasks of the double-precision widths
+static const uint64_t fp_arith[4] = {0x01c7, 0x04c7, 0x10c7, 0x40c7};
+static const double fp_width[4] = {1.0, 2.0, 4.0, 8.0};
+
+static int open_event(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/*
+ * Open the counters on all threads, returns the number of events
+ * available on all processes (collective)
+ */
+int perf_open(perf_t *perf, algoparam_t *param)
+{
+	int e, t, n = 0, intel;
+
+	memset(perf, 0, sizeof(perf_t));
+#ifdef _OPENMP
+	perf->nthreads = omp_get_max_threads();
+#else
+	perf->nthreads = 1;
+#endif
+	perf->fd = (int *)malloc(sizeof(int) * perf->nthreads * PERF_EVENTS);
+	if (!perf->fd)
+	{
+		perf->nthreads = 0;
+		return 0;
+	}
+	for (e = 0; e < perf->nthreads * PERF_EVENTS; e++)
+		perf->fd[e] = -1;
+
+	intel = __builtin_cpu_is("intel");
+
+#pragma omp parallel private(e)
+	{
+#ifdef _OPENMP
+		int *fd = perf->fd + omp_get_thread_num() * PERF_EVENTS;
+#else
+		int *fd = perf->fd;
+#endif
+
+		fd[PERF_CYCLES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+		fd[PERF_INSTRUCTIONS] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+		fd[PERF_LLC_MISSES] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		for (e = 0; e < 4 && intel; e++)
+			fd[PERF_FP_SCALAR + e] = open_event(PERF_TYPE_RAW, fp_arith[e]);
+	}
+
+	for (e = 0; e < PERF_EVENTS; e++)
+	{
+		perf->available[e] = 1;
+		for (t = 0; t < perf->nthreads; t++)
+			if (perf->fd[t * PERF_EVENTS + e] < 0)
+				perf->available[e] = 0;
+	}
+	MPI_Allreduce(MPI_IN_PLACE, perf->available, PERF_EVENTS, MPI_INT, MPI_MIN, param->comm);
+
+	for (e = 0; e < PERF_EVENTS; e++)
+		n += perf->available[e];
+
+	return n;
+}
+
+void perf_close(perf_t *perf)
+{
+	int e;
+
+	for (e = 0; e < perf->nthreads * PERF_EVENTS; e++)
+		if (perf->fd[e] >= 0)
+			close(perf->fd[e]);
+	free(perf->fd);
+	memset(perf, 0, sizeof(perf_t));
+}
+
+/*
+ * Counts since perf_open() summed over the threads, scaled if multiplexed
+ */
+static void perf_read(perf_t *perf, double *count)
+{
+	uint64_t v[3];
+	int e, t;
+
+	for (e = 0; e < PERF_EVENTS; e++)
+	{
+		count[e] = 0.0;
+		if (!perf->available[e])
+			continue;
+
+		for (t = 0; t < perf->nthreads; t++)
+			if (read(perf->fd[t * PERF_EVENTS + e], v, sizeof(v)) == sizeof(v) && v[2] > 0)
+				count[e] += (double)v[0] * ((double)v[1] / v[2]);
+	}
+}
+
+void perf_begin(perf_t *perf)
+{
+	if (!perf->nthreads)
+		return;
+
+	memset(perf->region, 0, sizeof(perf->region));
+	memset(perf->kernel, 0, sizeof(perf->kernel));
+	perf_read(perf, perf->start);
+}
+
+void perf_end(perf_t *perf)
+{
+	double now[PERF_EVENTS];
+	int e;
+
+	if (!perf->nthreads)
+		return;
+
+	perf_read(perf, now);
+	for (e = 0; e < PERF_EVENTS; e++)
+		perf->region[e] = now[e] - perf->start[e];
+}
+
+void perf_kernel_begin(perf_t *perf)
+{
+	if (perf->nthreads)
+		perf_read(perf, perf->kstart);
+}
+
+/*
+ * Add the counts since perf_kernel_begin() to kernel k
+ */
+void perf_kernel_end(perf_t *perf, int k)
+{
+	double now[PERF_EVENTS];
+	int e;
+
+	if (!perf->nthreads)
+		return;
+
+	perf_read(perf, now);
+	for (e = 0; e < PERF_EVENTS; e++)
+		perf->kernel[k][e] += now[e] - perf->kstart[e];
+}
+
+/*
+ * Executed Flops of the FP instruction counts, -1 if not available
+ */
+static double fp_ops(const perf_t *perf, const double *count)
+{
+	double flops = 0.0;
+	int e;
+
+	for (e = 0; e < 4; e++)
+	{
+		if (!perf->available[PERF_FP_SCALAR + e])
+			return -1.0;
+		flops += fp_width[e] * count[PERF_FP_SCALAR + e];
+	}
+
+	return flops;
+}
+
+/*
+ * Sum the counts of the region over all processes and print them next
+ * to the Flop count of the model on rank 0 (collective)
+ */
+void perf_report(perf_t *perf, algoparam_t *param, double runtime, double flop, unsigned iter)
+{
+	double sum[(1 + PERF_KERNELS) * PERF_EVENTS];
+	const double updates = (double)iter * param->act_res * param->act_res;
+	const double *c;
+	double flops;
+	int k;
+
+	if (!perf->nthreads)
+		return;
+
+	memcpy(sum, perf->region, sizeof(perf->region));
+	memcpy(sum + PERF_EVENTS, perf->kernel, sizeof(perf->kernel));
+	MPI_Reduce(param->rank == 0 ? MPI_IN_PLACE : sum, sum, (1 + PERF_KERNELS) * PERF_EVENTS,
+			   MPI_DOUBLE, MPI_SUM, 0, param->comm);
+	if (param->rank != 0)
+		return;
+
+	// the region, then the kernels that ran
+	for (k = 0; k <= PERF_KERNELS; k++)
+	{
+		c = sum + k * PERF_EVENTS;
+		if (k > 0 && c[PERF_CYCLES] == 0.0 && c[PERF_INSTRUCTIONS] == 0.0 && c[PERF_LLC_MISSES] == 0.0)
+			continue;
+
+		fprintf(stderr, "            %-8s: ", k == 0 ? "counters" : perf_kernel_names[k - 1]);
+		if (perf->available[PERF_CYCLES])
+			fprintf(stderr, "%.3g cycles", c[PERF_CYCLES]);
+		else
+			fprintf(stderr, "cycles n/a");
+		if (perf->available[PERF_CYCLES] && k > 0 && sum[PERF_CYCLES] > 0.0)
+			fprintf(stderr, " (%.1f%%)", 100.0 * c[PERF_CYCLES] / sum[PERF_CYCLES]);
+		if (perf->available[PERF_CYCLES] && perf->available[PERF_INSTRUCTIONS] && c[PERF_CYCLES] > 0.0)
+			fprintf(stderr, ", IPC %.2f", c[PERF_INSTRUCTIONS] / c[PERF_CYCLES]);
+
+		if (perf->available[PERF_LLC_MISSES])
+		{
+			fprintf(stderr, ", %.3g LLC misses (%.3f per update", c[PERF_LLC_MISSES], c[PERF_LLC_MISSES] / updates);
+			if (k == 0)
+				fprintf(stderr, ", %.1f MB/s", c[PERF_LLC_MISSES] * 64.0 / runtime / 1000000);
+			fprintf(stderr, ")");
+		}
+		else
+			fprintf(stderr, ", LLC misses n/a");
+
+		flops = fp_ops(perf, c);
+		if (flops >= 0.0)
+		{
+			fprintf(stderr, ", %.3f GFlop executed", flops / 1000000000.0);
+			if (k == 0)
+				fprintf(stderr, " (%.2f MFlop/s, %.2fx the counted Flops)",
+						flops / runtime / 1000000, flop > 0.0 ? flops / flop : 0.0);
+		}
+		fprintf(stderr, "\n");
+	}
+}
@@ -6,6 +6,7 @@
  */
 
 #include "heat.h"
+#include "timing.h"
 #include <mpi.h>
 #include <math.h>
 
@@ -20,37 +21,33 @@
 
 double residual_gauss(double *u, double *utmp, unsigned sizex, unsigned sizey, algoparam_t *param)
 {
+	const unsigned ld = param->ld;
 	unsigned i, j;
 	double unew, diff, sum = 0.0;
 
 	// Halo exchange for the "old" right and bottom values
-	MPI_Sendrecv(&u[1 * sizex], sizex, MPI_DOUBLE, param->top_neighbor, 0,
-				 &u[0], sizex, MPI_DOUBLE, param->top_neighbor, 0,
-				 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-	MPI_Sendrecv(&u[(sizey - 2) * sizex], sizex, MPI_DOUBLE, param->bottom_neighbor, 0,
-				 &u[(sizey - 1) * sizex], sizex, MPI_DOUBLE, param->bottom_neighbor, 0,
-				 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	exchange_halo(u, sizex, sizey, param);
 
 	// first row (boundary condition) into utmp
 	for (j = 0; j < sizex; j++)
-		utmp[0 * sizex + j] = u[0 * sizex + j];
+		utmp[0 * ld + j] = u[0 * ld + j];
 	// first column (boundary condition) into utmp
 	for (i = 1; i < sizey - 1; i++)
-		utmp[i * sizex + 0] = u[i * sizex + 0];
+		utmp[i * ld + 0] = u[i * ld + 0];
 
 	for (i = 1; i < sizey - 1; i++)
 	{
 		for (j = 1; j < sizex - 1; j++)
 		{
-			unew = 0.25 * (utmp[i * sizex + (j - 1)] + // new left
-						   u[i * sizex + (j + 1)] +	   // right
-						   utmp[(i - 1) * sizex + j] + // new top
-						   u[(i + 1) * sizex + j]);	   // bottom
+			unew = 0.25 * (utmp[i * ld + (j - 1)] + // new left
+						   u[i * ld + (j + 1)] +	// right
+						   utmp[(i - 1) * ld + j] + // new top
+						   u[(i + 1) * ld + j]);	// bottom
 
-			diff = unew - u[i * sizex + j];
+			diff = unew - u[i * ld + j];
 			sum += diff * diff;
 
-			utmp[i * sizex + j] = unew;
+			utmp[i * ld + j] = unew;
 		}
 	}
 
@@ -60,32 +57,122 @@ double residual_gauss(double *u, double *utmp, unsigned sizex, unsigned sizey, a
 /*
  * One Gauss-Seidel iteration step
  *
- * Flop count in inner body is 4
+ * The lexicographic ordering is kept across the ranks: a block needs the
+ * new values of the last row of its top neighbor and of the last column of
+ * its left neighbor. The local columns are processed in blocks of
+ * param->gs_block columns (0 => whole rows), and the last row segment of
+ * each block is sent downstream as soon as it is finished, so the rank
+ * below can start with its first block while this rank works on the next.
+ *
+ * The update is over-relaxed with param->omega (SOR), omega = 1 is plain
+ * Gauss-Seidel.
+ *
+ * Flop count in inner body is 6
  */
 void relax_gauss(double *u, unsigned sizex, unsigned sizey, algoparam_t *param)
 {
-	unsigned i, j;
+	const double omega = param->omega;
+	const int ld = param->ld;
+	const int cols = sizex - 2;
+	const int bw = (param->gs_block > 0 && param->gs_block < cols) ? param->gs_block : (cols > 0 ? cols : 1);
+	const int nblocks = (cols + bw - 1) / bw;
+	MPI_Request recv_req[nblocks], send_req[nblocks];
+	int b, i, j, j0, j1;
+	double t0;
+
+	// post the receives for the top ghost row segments
+	for (b = 0; b < nblocks; b++)
+	{
+		j0 = 1 + b * bw;
+		j1 = (j0 + bw < sizex - 1) ? j0 + bw : sizex - 1;
+		MPI_Irecv(&u[0 * ld + j0], j1 - j0, MPI_DOUBLE, param->top_neighbor, 4, param->comm, &recv_req[b]);
+	}
 
-	// The dependency flows from top to bottom.
-	// Each process must receive the updated boundary from its top neighbor before starting.
+	// the whole new left ghost column is needed by the first block,
+	// waiting in the pipeline is booked as halo exchange
+	t0 = wtime();
+	MPI_Recv(&u[1 * ld + 0], 1, param->column_t, param->left_neighbor, 5, param->comm, MPI_STATUS_IGNORE);
+	phase_add(PHASE_HALO, t0);
 
-	for (i = 1; i < sizey - 1; i++)
+	for (b = 0; b < nblocks; b++)
 	{
-		// Receive updated halo from top neighbor before computing row i
-		if (i == 1 && param->top_neighbor != -1)
-		{
-			MPI_Recv(&u[0], sizex, MPI_DOUBLE, param->top_neighbor, 1, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-		}
+		j0 = 1 + b * bw;
+		j1 = (j0 + bw < sizex - 1) ? j0 + bw : sizex - 1;
 
-		for (j = 1; j < sizex - 1; j++)
+		t0 = wtime();
+		MPI_Wait(&recv_req[b], MPI_STATUS_IGNORE);
+		phase_add(PHASE_HALO, t0);
+
+		for (i = 1; i < sizey - 1; i++)
 		{
-			u[i * sizex + j] = 0.25 * (u[i * sizex + (j - 1)] + u[i * sizex + (j + 1)] + u[(i - 1) * sizex + j] + u[(i + 1) * sizex + j]);
+			for (j = j0; j < j1; j++)
+			{
+				u[i * ld + j] += omega * (0.25 * (u[i * ld + (j - 1)] + u[i * ld + (j + 1)] + u[(i - 1) * ld + j] + u[(i + 1) * ld + j]) -
+										  u[i * ld + j]);
+			}
 		}
 
-		// Send newly computed row i to bottom neighbor
-		if (param->bottom_neighbor != -1)
+		// Send the newly computed segment of the last row downstream
+		MPI_Isend(&u[(sizey - 2) * ld + j0], j1 - j0, MPI_DOUBLE, param->bottom_neighbor, 4, param->comm, &send_req[b]);
+	}
+
+	// Send the newly computed last column downstream
+	t0 = wtime();
+	MPI_Send(&u[1 * ld + (sizex - 2)], 1, param->column_t, param->right_neighbor, 5, param->comm);
+
+	MPI_Waitall(nblocks, send_req, MPI_STATUSES_IGNORE);
+	phase_add(PHASE_HALO, t0);
+}
+
+/*
+ * Adapt the SOR factor to the observed decay of the global residual
+ * (Hageman & Young). Below the optimum the residual decays by lambda per
+ * iteration, which gives an estimate of the squared spectral radius of
+ * the Jacobi iteration
+ *
+ *   mu^2 = (lambda + omega - 1)^2 / (lambda omega^2)
+ *
+ * and with it the new factor 2 / (1 + sqrt(1 - mu^2)). Near the optimum
+ * the decay approaches omega - 1 and the estimate gets unreliable, so
+ * omega is only increased while lambda > (omega - 1)^SOR_ADAPT_F.
+ *
+ * lambda is measured over windows of act_res / 4 iterations, the window
+ * following a change of omega is skipped to let the transient decay.
+ * residual is the global residual after iteration iter, so all ranks
+ * arrive at the same omega.
+ */
+#define SOR_ADAPT_F 0.75
+
+void adapt_omega(algoparam_t *param, double residual, unsigned iter)
+{
+	const unsigned window = param->act_res / 4 > 10 ? param->act_res / 4 : 10;
+	double lambda, mu2, omega;
+
+	if (param->omega_mode != 2 || residual <= 0.0)
+		return;
+
+	if (param->omega_iter > 0 && iter < param->omega_iter + window)
+		return;
+
+	if (param->omega_iter > 0 && param->omega_res > 0.0)
+	{
+		lambda = pow(residual / param->omega_res, 1.0 / (iter - param->omega_iter));
+		if (lambda < 1.0 && lambda > pow(param->omega - 1.0, SOR_ADAPT_F))
 		{
-			MPI_Send(&u[i * sizex], sizex, MPI_DOUBLE, param->bottom_neighbor, 1, MPI_COMM_WORLD);
+			mu2 = (lambda + param->omega - 1.0) * (lambda + param->omega - 1.0) /
+				  (lambda * param->omega * param->omega);
+			omega = mu2 < 1.0 ? 2.0 / (1.0 + sqrt(1.0 - mu2)) : param->omega;
+			if (omega > param->omega)
+			{
+				// skip the next window
+				param->omega = omega;
+				param->omega_res = 0.0;
+				param->omega_iter = iter;
+				return;
+			}
 		}
 	}
-}
\ No newline at end of file
+
+	param->omega_res = residual;
+	param->omega_iter = iter;
+}
@@ -9,64 +9,149 @@
 #include <mpi.h>
 #include <math.h>
 
+// minimum number of rows of a block to be split among threads
+#define JACOBI_THREAD_ROWS 8
+
 /*
- * Residual (length of error vector)
- * between current solution and next after a Jacobi step
+ * Jacobi update of the rows [i0, i1) and columns [j0, j1) of the local block
+ * (rows ld points apart)
+ *
+ * The rows are split statically among the threads of the hybrid build,
+ * matching the first touch in initialize(). Thin strips of the ring stay
+ * on the master thread. nt selects non-temporal stores to utmp.
+ *
+ * With tile > 0 the block is swept in column strips of tile points, so
+ * the three rows of u the stencil reads stay in L1/L2 even for large
+ * resolutions. Every thread keeps its rows in all strips (static
+ * schedule), so the strips need no barrier in between.
  */
-double residual_jacobi(double *u, unsigned sizex, unsigned sizey, algoparam_t *param)
+static void jacobi_block(double *u, double *utmp, unsigned ld,
+						 unsigned i0, unsigned i1, unsigned j0, unsigned j1, int tile, int nt)
 {
-	unsigned i, j;
-	double unew, diff, sum = 0.0;
+	const int tw = (tile > 0) ? tile : (int)(j1 - j0);
+	int i, jj;
 
-	for (i = 1; i < sizey - 1; i++)
+#pragma omp parallel private(jj) if (i1 - i0 > JACOBI_THREAD_ROWS)
+	for (jj = j0; jj < (int)j1; jj += tw)
 	{
-		for (j = 1; j < sizex - 1; j++)
-		{
-			unew = 0.25 * (u[i * sizex + (j - 1)] + // left
-						   u[i * sizex + (j + 1)] + // right
-						   u[(i - 1) * sizex + j] + // top
-						   u[(i + 1) * sizex + j]); // bottom
+#pragma omp for schedule(static) nowait
+		for (i = i0; i < (int)i1; i++)
+			jacobi_row(u + i * ld, utmp + i * ld, ld, jj, (jj + tw < (int)j1) ? jj + tw : (int)j1, nt);
+	}
+}
 
-			diff = unew - u[i * sizex + j];
-			sum += diff * diff;
-		}
+/*
+ * Jacobi update of the rows [i0, i1) and columns [j0, j1) of the local block,
+ * returns the squared difference between new and old values
+ */
+static double jacobi_residual_block(double *restrict u, double *restrict utmp, unsigned ld,
+									unsigned i0, unsigned i1, unsigned j0, unsigned j1, int tile, int nt)
+{
+	const int tw = (tile > 0) ? tile : (int)(j1 - j0);
+	int i, jj;
+	double sum = 0.0;
+
+#pragma omp parallel private(jj) reduction(+ : sum) if (i1 - i0 > JACOBI_THREAD_ROWS)
+	for (jj = j0; jj < (int)j1; jj += tw)
+	{
+#pragma omp for schedule(static) nowait
+		for (i = i0; i < (int)i1; i++)
+			sum += jacobi_residual_row(u + i * ld, utmp + i * ld, ld, jj, (jj + tw < (int)j1) ? jj + tw : (int)j1, nt);
 	}
 
 	return sum;
 }
 
 /*
- * One Jacobi iteration step
+ * One Jacobi iteration step (single ghost layer)
+ *
+ * With param->overlap the halo exchange is started nonblocking, the
+ * interior points that need no ghost cells are updated while the messages
+ * are in flight, and the outermost rows and columns are finished afterwards.
  */
 void relax_jacobi(double *u, double *utmp, unsigned sizex, unsigned sizey, algoparam_t *param)
 {
-	int i, j;
+	MPI_Request req[8];
 
-	// Halo exchange: send own boundary rows and receive ghost rows
-	// Send row 1 to top neighbor, receive into row 0
-	if (param->rank != 0)
+	if (!param->overlap || sizex < 4 || sizey < 4)
 	{
-		MPI_Sendrecv(&u[1 * sizex], sizex, MPI_DOUBLE, param->top_neighbor, 0,
-					 &u[0], sizex, MPI_DOUBLE, param->top_neighbor, 0,
-					 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
-	}
+		// Halo exchange: send own boundary rows/columns and receive ghost cells
+		exchange_halo(u, sizex, sizey, param);
 
-	// Send row sizey-2 to bottom neighbor, receive into row sizey-1
-	if (param->rank != param->size - 1)
-	{
-		MPI_Sendrecv(&u[(sizey - 2) * sizex], sizex, MPI_DOUBLE, param->bottom_neighbor, 0,
-					 &u[(sizey - 1) * sizex], sizex, MPI_DOUBLE, param->bottom_neighbor, 0,
-					 MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		jacobi_block(u, utmp, param->ld, 1, sizey - 1, 1, sizex - 1, param->tile, param->simd_stream);
+		return;
 	}
 
-	for (i = 1; i < sizey - 1; i++)
+	exchange_halo_begin(u, sizex, sizey, param, req);
+
+	// interior, independent of the ghost cells
+	jacobi_block(u, utmp, param->ld, 2, sizey - 2, 2, sizex - 2, param->tile, param->simd_stream);
+
+	exchange_halo_end(req);
+
+	// first and last row, then first and last column
+	jacobi_block(u, utmp, param->ld, 1, 2, 1, sizex - 1, 0, 0);
+	jacobi_block(u, utmp, param->ld, sizey - 2, sizey - 1, 1, sizex - 1, 0, 0);
+	jacobi_block(u, utmp, param->ld, 2, sizey - 2, 1, 2, 0, 0);
+	jacobi_block(u, utmp, param->ld, 2, sizey - 2, sizex - 2, sizex - 1, 0, 0);
+}
+
+/*
+ * Combined Jacobi iteration and residual calculation
+ *
+ * Same halo exchange as relax_jacobi(), but the residual between the old
+ * and the new iterate is accumulated in the same pass, so the grid is read
+ * only once per iteration.
+ *
+ * With a deep halo (param->halo = k > 1) the ghost layers are exchanged
+ * only every k sweeps. In between, each sweep also updates the ghost
+ * layers that are still valid, recomputing the overlap with the neighbors
+ * redundantly; the residual is taken over the owned points only.
+ */
+double relax_jacobi_residual(double *restrict u, double *restrict utmp, unsigned sizex, unsigned sizey, algoparam_t *param)
+{
+	MPI_Request req[8];
+	double sum;
+
+	if (param->halo > 1 || !param->overlap || sizex < 4 || sizey < 4)
 	{
-		for (j = 1; j < sizex - 1; j++)
+		const int h = param->halo;
+		const int e = h - 1 - param->sweep % h; // ghost layers still to update
+		int i0, i1, j0, j1;
+
+		if (param->sweep % h == 0)
+			exchange_halo(u, sizex, sizey, param);
+		param->sweep++;
+
+		// owned block extended by e layers, clipped at the physical boundary
+		i0 = h - (param->top_neighbor == MPI_PROC_NULL ? 0 : e);
+		i1 = sizey - h + (param->bottom_neighbor == MPI_PROC_NULL ? 0 : e);
+		j0 = h - (param->left_neighbor == MPI_PROC_NULL ? 0 : e);
+		j1 = sizex - h + (param->right_neighbor == MPI_PROC_NULL ? 0 : e);
+
+		if (e > 0)
 		{
-			utmp[i * sizex + j] = 0.25 * (u[i * sizex + (j - 1)] + // left
-										  u[i * sizex + (j + 1)] + // right
-										  u[(i - 1) * sizex + j] + // top
-										  u[(i + 1) * sizex + j]); // bottom
+			jacobi_block(u, utmp, param->ld, i0, h, j0, j1, 0, 0);
+			jacobi_block(u, utmp, param->ld, sizey - h, i1, j0, j1, 0, 0);
+			jacobi_block(u, utmp, param->ld, h, sizey - h, j0, h, 0, 0);
+			jacobi_block(u, utmp, param->ld, h, sizey - h, sizex - h, j1, 0, 0);
+			param->redundant_points += (double)(i1 - i0) * (j1 - j0) -
+									   (double)(sizey - 2 * h) * (sizex - 2 * h);
 		}
+
+		return jacobi_residual_block(u, utmp, param->ld, h, sizey - h, h, sizex - h, param->tile, param->simd_stream);
 	}
-}
\ No newline at end of file
+
+	exchange_halo_begin(u, sizex, sizey, param, req);
+
+	sum = jacobi_residual_block(u, utmp, param->ld, 2, sizey - 2, 2, sizex - 2, param->tile, param->simd_stream);
+
+	exchange_halo_end(req);
+
+	sum += jacobi_residual_block(u, utmp, param->ld, 1, 2, 1, sizex - 1, 0, 0);
+	sum += jacobi_residual_block(u, utmp, param->ld, sizey - 2, sizey - 1, 1, sizex - 1, 0, 0);
+	sum += jacobi_residual_block(u, utmp, param->ld, 2, sizey - 2, 1, 2, 0, 0);
+	sum += jacobi_residual_block(u, utmp, param->ld, 2, sizey - 2, sizex - 2, sizex - 1, 0, 0);
+
+	return sum;
+}
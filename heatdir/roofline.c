@@ -0,0 +1,161 @@
+/*
+ * roofline.c
+ *
+ * Memory bandwidth probe and traffic model of the sweeps
+ *
+ * At startup all processes run the STREAM triad a = b + s c at the same
+ * time with all their threads, on arrays that are together at least four
+ * times the last level cache of a node, so the measured bandwidth is the
+ * one the sweeps share. As in STREAM, the best of several repetitions
+ * counts; a repetition takes as long as its slowest process. Unlike
+ * STREAM, 32 bytes are counted per element, including the write-allocate
+ * of a, which the traffic model below counts as well.
+ *
+ * The sweeps are memory-bound, so the roofline of a run is its arithmetic
+ * intensity (counted Flops per byte of the traffic model) times the
+ * measured bandwidth. The traffic model counts the compulsory main memory
+ * traffic of a point update, assuming the neighbouring rows stay in the
+ * cache; grids that fit into the cache can exceed the roofline.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "heat.h"
+#include "timing.h"
+
+#define STREAM_REPEAT 10
+#define STREAM_MIN_N (1L << 21)  // elements per array and process
+#define STREAM_LLC (32L << 20)   // last level cache if sysconf() does not know
+
+/*
+ * Measure the triad bandwidth of all processes (collective),
+ * returns 1 on success
+ */
+int roofline_probe(algoparam_t *param, roofline_t *roof)
+{
+	MPI_Comm node;
+	long n, i, llc = -1;
+	double *a, *b, *c, t, best = -1.0;
+	int k, ok;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+	llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+	if (llc <= 0)
+		llc = STREAM_LLC;
+
+	// the processes of a node share the cache
+	MPI_Comm_split_type(param->comm, MPI_COMM_TYPE_SHARED, param->rank, MPI_INFO_NULL, &node);
+	MPI_Comm_size(node, &roof->node_size);
+	MPI_Comm_free(&node);
+
+	n = 4 * llc / (3 * sizeof(double)) / roof->node_size;
+	if (n < STREAM_MIN_N)
+		n = STREAM_MIN_N;
+
+	a = (double *)malloc(sizeof(double) * n);
+	b = (double *)malloc(sizeof(double) * n);
+	c = (double *)malloc(sizeof(double) * n);
+	ok = a && b && c;
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, param->comm);
+	if (!ok)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		free(a);
+		free(b);
+		free(c);
+		return 0;
+	}
+
+	// first touch with the schedule of the triad
+#pragma omp parallel for schedule(static)
+	for (i = 0; i < n; i++)
+	{
+		a[i] = 0.0;
+		b[i] = 1.0;
+		c[i] = 2.0;
+	}
+
+	for (k = 0; k < STREAM_REPEAT; k++)
+	{
+		MPI_Barrier(param->comm);
+		t = wtime();
+#pragma omp parallel for schedule(static)
+		for (i = 0; i < n; i++)
+			a[i] = b[i] + 3.0 * c[i];
+		t = wtime() - t;
+
+		MPI_Allreduce(MPI_IN_PLACE, &t, 1, MPI_DOUBLE, MPI_MAX, param->comm);
+		if (k > 0 && (best < 0.0 || t < best)) // first repetition is a warm-up
+			best = t;
+	}
+
+	// check the result like STREAM, which also keeps the stores alive
+	ok = a[0] == 7.0 && a[n / 2] == 7.0 && a[n - 1] == 7.0;
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, param->comm);
+
+	roof->n = n;
+	roof->bandwidth = ok ? 4.0 * sizeof(double) * n * param->size / best : 0.0;
+#ifdef _OPENMP
+	roof->threads = omp_get_max_threads();
+#else
+	roof->threads = 1;
+#endif
+
+	free(a);
+	free(b);
+	free(c);
+
+	if (!ok && param->rank == 0)
+		fprintf(stderr, "Error: STREAM triad validation failed\n");
+
+	return ok;
+}
+
+/*
+ * Main memory traffic of the traffic model per point update and iteration
+ */
+double bytes_per_update(algoparam_t *param)
+{
+	switch (param->algorithm)
+	{
+	case 0: // read u, write uhelp with write-allocate unless streamed
+		return param->simd_stream && param->simd > 0 ? 16.0 : 24.0;
+	case 1: // in-place sweep, residual into utmp
+		return 16.0 + 24.0;
+	case 2: // two in-place half sweeps over the whole grid
+		return 2 * 16.0;
+	case 3:
+		return bytes_multigrid(param);
+	case 4:
+		return bytes_cg(param);
+	}
+
+	return 0.0;
+}
+
+/*
+ * Bandwidth, arithmetic intensity and share of the roofline of a run
+ * of iter iterations (rank 0), param->float_sweeps of them on the float
+ * grids of the mixed-precision mode (half the bytes of the double sweep)
+ */
+void roofline_report(roofline_t *roof, algoparam_t *param, double runtime, double flop, unsigned iter)
+{
+	const double bytes = ((double)(iter - param->float_sweeps) * bytes_per_update(param) +
+						  (double)param->float_sweeps * 12.0) *
+						 param->act_res * param->act_res;
+	const double intensity = flop / bytes;
+
+	if (roof->bandwidth <= 0.0 || bytes <= 0.0 || runtime <= 0.0)
+		return;
+
+	fprintf(stderr, "            roofline: %.2f GB/s of %.2f GB/s measured (%.1f%%), "
+					"%.3f Flop/byte => bound %.2f MFlop/s\n",
+			bytes / runtime / 1e9, roof->bandwidth / 1e9, 100.0 * bytes / runtime / roof->bandwidth,
+			intensity, intensity * roof->bandwidth / 1000000);
+}
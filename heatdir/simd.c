@@ -0,0 +1,472 @@
+/*
+ * simd.c
+ *
+ * Row kernels of the Jacobi and red-black sweeps with explicit
+ * AVX2 and AVX-512 implementations
+ *
+ * The instruction set is selected once at startup with CPUID
+ * (__builtin_cpu_supports), the vector versions are compiled with target
+ * attributes, so the binary does not depend on -xCORE-AVX512 or
+ * -qopt-zmm-usage. All versions add the neighbors in the same order as
+ * the scalar code, the new values are bitwise identical; only the
+ * partial sums of the residual differ in rounding.
+ *
+ * Non-temporal stores (nt, --nt-stores) write the Jacobi target row
+ * past the cache, the row is peeled up to the vector alignment of the
+ * target. They only pay off where the write-allocate traffic dominates,
+ * so they are off by default. Loads are unaligned, since the stencil
+ * reads the neighbors j - 1 and j + 1 of every point. ld is the row
+ * stride of the grids.
+ *
+ * The float kernels of the mixed-precision mode widen the stored values
+ * to double, so the stencil and the residual are computed exactly as in
+ * the double kernels; only the new values are rounded to float.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "heat.h"
+
+const char *simd_names[] = {"scalar", "AVX2", "AVX-512"};
+
+/*
+ * Scalar kernels
+ */
+
+static void jacobi_row_scalar(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	int j;
+
+	for (j = j0; j < j1; j++)
+		trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+}
+
+static double jacobi_residual_row_scalar(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	double diff, sum = 0.0;
+	int j;
+
+	for (j = j0; j < j1; j++)
+	{
+		trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		diff = trow[j] - urow[j];
+		sum += diff * diff;
+	}
+
+	return sum;
+}
+
+static double redblack_row_scalar(double *restrict urow, int ld, int j0, int j1, double omega)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	double diff, sum = 0.0;
+	int j;
+
+	for (j = j0; j < j1; j += 2)
+	{
+		diff = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]) - urow[j];
+		sum += diff * diff;
+		urow[j] += omega * diff;
+	}
+
+	return sum;
+}
+
+static double jacobi_residual_row_float_scalar(const float *restrict urow, float *restrict trow, int ld, int j0, int j1)
+{
+	const float *above = urow - ld, *below = urow + ld;
+	double unew, diff, sum = 0.0;
+	int j;
+
+	for (j = j0; j < j1; j++)
+	{
+		unew = 0.25 * ((double)urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		diff = unew - urow[j];
+		sum += diff * diff;
+		trow[j] = (float)unew;
+	}
+
+	return sum;
+}
+
+/*
+ * AVX2: 4 doubles per vector
+ */
+
+#define AVX2 __attribute__((target("avx2")))
+
+AVX2 static inline __m256d stencil_avx2(const double *urow, const double *above, const double *below, int j)
+{
+	__m256d s = _mm256_add_pd(_mm256_loadu_pd(&urow[j - 1]), _mm256_loadu_pd(&urow[j + 1]));
+	s = _mm256_add_pd(s, _mm256_loadu_pd(&above[j]));
+	s = _mm256_add_pd(s, _mm256_loadu_pd(&below[j]));
+	return _mm256_mul_pd(_mm256_set1_pd(0.25), s);
+}
+
+AVX2 static inline double hsum_avx2(__m256d v)
+{
+	__m128d s = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+	return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+AVX2 static void jacobi_row_avx2(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	int j = j0;
+
+	if (nt)
+	{
+		for (; j < j1 && ((uintptr_t)&trow[j] & 31); j++)
+			trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		for (; j + 4 <= j1; j += 4)
+			_mm256_stream_pd(&trow[j], stencil_avx2(urow, above, below, j));
+		_mm_sfence();
+	}
+	else
+	{
+		for (; j + 4 <= j1; j += 4)
+			_mm256_storeu_pd(&trow[j], stencil_avx2(urow, above, below, j));
+	}
+
+	for (; j < j1; j++)
+		trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+}
+
+AVX2 static double jacobi_residual_row_avx2(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	__m256d unew, diff, acc = _mm256_setzero_pd();
+	double d, sum = 0.0;
+	int j = j0;
+
+	if (nt)
+	{
+		for (; j < j1 && ((uintptr_t)&trow[j] & 31); j++)
+		{
+			trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+			d = trow[j] - urow[j];
+			sum += d * d;
+		}
+		for (; j + 4 <= j1; j += 4)
+		{
+			unew = stencil_avx2(urow, above, below, j);
+			diff = _mm256_sub_pd(unew, _mm256_loadu_pd(&urow[j]));
+			acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+			_mm256_stream_pd(&trow[j], unew);
+		}
+		_mm_sfence();
+	}
+	else
+	{
+		for (; j + 4 <= j1; j += 4)
+		{
+			unew = stencil_avx2(urow, above, below, j);
+			diff = _mm256_sub_pd(unew, _mm256_loadu_pd(&urow[j]));
+			acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+			_mm256_storeu_pd(&trow[j], unew);
+		}
+	}
+
+	for (; j < j1; j++)
+	{
+		trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		d = trow[j] - urow[j];
+		sum += d * d;
+	}
+
+	return sum + hsum_avx2(acc);
+}
+
+/*
+ * The vector starts at a point of the colour, so lanes 0 and 2 are
+ * updated. The other lanes keep their value (their difference is masked
+ * to zero) and are written back unchanged; they belong to the other
+ * colour and are not modified in this half-sweep.
+ *
+ * The left neighbors of the next vector overlap the store of the current
+ * one. They are assembled in registers from the current and the next
+ * center instead, which are loaded before the store, so no load has to
+ * wait for a partially overlapping store (store forwarding stall).
+ */
+AVX2 static double redblack_row_avx2(double *restrict urow, int ld, int j0, int j1, double omega)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	const __m256d mask = _mm256_castsi256_pd(_mm256_set_epi64x(0, -1, 0, -1));
+	const __m256d w = _mm256_set1_pd(omega);
+	__m256d l, c, n, s, diff, acc = _mm256_setzero_pd();
+	double d, sum = 0.0;
+	int j = j0;
+
+	l = _mm256_loadu_pd(&urow[j - 1]);
+	c = _mm256_loadu_pd(&urow[j]);
+	for (; j + 4 <= j1; j += 4)
+	{
+		n = (j + 8 <= j1) ? _mm256_loadu_pd(&urow[j + 4]) : _mm256_setzero_pd();
+
+		s = _mm256_add_pd(l, _mm256_loadu_pd(&urow[j + 1]));
+		s = _mm256_add_pd(s, _mm256_loadu_pd(&above[j]));
+		s = _mm256_add_pd(s, _mm256_loadu_pd(&below[j]));
+		diff = _mm256_and_pd(_mm256_sub_pd(_mm256_mul_pd(_mm256_set1_pd(0.25), s), c), mask);
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+
+		// left neighbors of the next vector: lane 3 of c, lanes 0..2 of n
+		l = _mm256_blend_pd(_mm256_permute4x64_pd(n, _MM_SHUFFLE(2, 1, 0, 3)),
+							_mm256_permute4x64_pd(c, _MM_SHUFFLE(3, 3, 3, 3)), 0x1);
+
+		_mm256_storeu_pd(&urow[j], _mm256_add_pd(c, _mm256_mul_pd(w, diff)));
+		c = n;
+	}
+
+	for (; j < j1; j += 2)
+	{
+		d = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]) - urow[j];
+		sum += d * d;
+		urow[j] += omega * d;
+	}
+
+	return sum + hsum_avx2(acc);
+}
+
+AVX2 static inline __m256d widen_avx2(const float *v)
+{
+	return _mm256_cvtps_pd(_mm_loadu_ps(v));
+}
+
+AVX2 static double jacobi_residual_row_float_avx2(const float *restrict urow, float *restrict trow, int ld, int j0, int j1)
+{
+	const float *above = urow - ld, *below = urow + ld;
+	__m256d unew, diff, acc = _mm256_setzero_pd();
+	double d, sum = 0.0;
+	int j;
+
+	for (j = j0; j + 4 <= j1; j += 4)
+	{
+		unew = _mm256_add_pd(widen_avx2(&urow[j - 1]), widen_avx2(&urow[j + 1]));
+		unew = _mm256_add_pd(unew, widen_avx2(&above[j]));
+		unew = _mm256_add_pd(unew, widen_avx2(&below[j]));
+		unew = _mm256_mul_pd(_mm256_set1_pd(0.25), unew);
+		diff = _mm256_sub_pd(unew, widen_avx2(&urow[j]));
+		acc = _mm256_add_pd(acc, _mm256_mul_pd(diff, diff));
+		_mm_storeu_ps(&trow[j], _mm256_cvtpd_ps(unew));
+	}
+
+	for (; j < j1; j++)
+	{
+		d = 0.25 * ((double)urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		trow[j] = (float)d;
+		d -= urow[j];
+		sum += d * d;
+	}
+
+	return sum + hsum_avx2(acc);
+}
+
+/*
+ * AVX-512: 8 doubles per vector
+ */
+
+#define AVX512 __attribute__((target("avx512f")))
+
+AVX512 static inline __m512d stencil_avx512(const double *urow, const double *above, const double *below, int j)
+{
+	__m512d s = _mm512_add_pd(_mm512_loadu_pd(&urow[j - 1]), _mm512_loadu_pd(&urow[j + 1]));
+	s = _mm512_add_pd(s, _mm512_loadu_pd(&above[j]));
+	s = _mm512_add_pd(s, _mm512_loadu_pd(&below[j]));
+	return _mm512_mul_pd(_mm512_set1_pd(0.25), s);
+}
+
+AVX512 static void jacobi_row_avx512(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	int j = j0;
+
+	if (nt)
+	{
+		for (; j < j1 && ((uintptr_t)&trow[j] & 63); j++)
+			trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		for (; j + 8 <= j1; j += 8)
+			_mm512_stream_pd(&trow[j], stencil_avx512(urow, above, below, j));
+		_mm_sfence();
+	}
+	else
+	{
+		for (; j + 8 <= j1; j += 8)
+			_mm512_storeu_pd(&trow[j], stencil_avx512(urow, above, below, j));
+	}
+
+	for (; j < j1; j++)
+		trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+}
+
+AVX512 static double jacobi_residual_row_avx512(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	__m512d unew, diff, acc = _mm512_setzero_pd();
+	double d, sum = 0.0;
+	int j = j0;
+
+	if (nt)
+	{
+		for (; j < j1 && ((uintptr_t)&trow[j] & 63); j++)
+		{
+			trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+			d = trow[j] - urow[j];
+			sum += d * d;
+		}
+		for (; j + 8 <= j1; j += 8)
+		{
+			unew = stencil_avx512(urow, above, below, j);
+			diff = _mm512_sub_pd(unew, _mm512_loadu_pd(&urow[j]));
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+			_mm512_stream_pd(&trow[j], unew);
+		}
+		_mm_sfence();
+	}
+	else
+	{
+		for (; j + 8 <= j1; j += 8)
+		{
+			unew = stencil_avx512(urow, above, below, j);
+			diff = _mm512_sub_pd(unew, _mm512_loadu_pd(&urow[j]));
+			acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+			_mm512_storeu_pd(&trow[j], unew);
+		}
+	}
+
+	for (; j < j1; j++)
+	{
+		trow[j] = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		d = trow[j] - urow[j];
+		sum += d * d;
+	}
+
+	return sum + _mm512_reduce_add_pd(acc);
+}
+
+AVX512 static double redblack_row_avx512(double *restrict urow, int ld, int j0, int j1, double omega)
+{
+	const double *above = urow - ld, *below = urow + ld;
+	const __m512d w = _mm512_set1_pd(omega);
+	__m512d l, c, n, s, diff, acc = _mm512_setzero_pd();
+	double d, sum = 0.0;
+	int j = j0;
+
+	// lanes 0, 2, 4, 6 hold the points of the colour, see redblack_row_avx2()
+	l = _mm512_loadu_pd(&urow[j - 1]);
+	c = _mm512_loadu_pd(&urow[j]);
+	for (; j + 8 <= j1; j += 8)
+	{
+		n = (j + 16 <= j1) ? _mm512_loadu_pd(&urow[j + 8]) : _mm512_setzero_pd();
+
+		s = _mm512_add_pd(l, _mm512_loadu_pd(&urow[j + 1]));
+		s = _mm512_add_pd(s, _mm512_loadu_pd(&above[j]));
+		s = _mm512_add_pd(s, _mm512_loadu_pd(&below[j]));
+		diff = _mm512_maskz_sub_pd(0x55, _mm512_mul_pd(_mm512_set1_pd(0.25), s), c);
+		acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+
+		// left neighbors of the next vector: lane 7 of c, lanes 0..6 of n
+		l = _mm512_castsi512_pd(_mm512_alignr_epi64(_mm512_castpd_si512(n), _mm512_castpd_si512(c), 7));
+
+		_mm512_storeu_pd(&urow[j], _mm512_add_pd(c, _mm512_mul_pd(w, diff)));
+		c = n;
+	}
+
+	for (; j < j1; j += 2)
+	{
+		d = 0.25 * (urow[j - 1] + urow[j + 1] + above[j] + below[j]) - urow[j];
+		sum += d * d;
+		urow[j] += omega * d;
+	}
+
+	return sum + _mm512_reduce_add_pd(acc);
+}
+
+AVX512 static inline __m512d widen_avx512(const float *v)
+{
+	return _mm512_cvtps_pd(_mm256_loadu_ps(v));
+}
+
+AVX512 static double jacobi_residual_row_float_avx512(const float *restrict urow, float *restrict trow, int ld, int j0, int j1)
+{
+	const float *above = urow - ld, *below = urow + ld;
+	__m512d unew, diff, acc = _mm512_setzero_pd();
+	double d, sum = 0.0;
+	int j;
+
+	for (j = j0; j + 8 <= j1; j += 8)
+	{
+		unew = _mm512_add_pd(widen_avx512(&urow[j - 1]), widen_avx512(&urow[j + 1]));
+		unew = _mm512_add_pd(unew, widen_avx512(&above[j]));
+		unew = _mm512_add_pd(unew, widen_avx512(&below[j]));
+		unew = _mm512_mul_pd(_mm512_set1_pd(0.25), unew);
+		diff = _mm512_sub_pd(unew, widen_avx512(&urow[j]));
+		acc = _mm512_add_pd(acc, _mm512_mul_pd(diff, diff));
+		_mm256_storeu_ps(&trow[j], _mm512_cvtpd_ps(unew));
+	}
+
+	for (; j < j1; j++)
+	{
+		d = 0.25 * ((double)urow[j - 1] + urow[j + 1] + above[j] + below[j]);
+		trow[j] = (float)d;
+		d -= urow[j];
+		sum += d * d;
+	}
+
+	return sum + _mm512_reduce_add_pd(acc);
+}
+
+/*
+ * Dispatch
+ */
+
+void (*jacobi_row)(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt) = jacobi_row_scalar;
+double (*jacobi_residual_row)(const double *restrict urow, double *restrict trow, int ld, int j0, int j1, int nt) = jacobi_residual_row_scalar;
+double (*redblack_row)(double *restrict urow, int ld, int j0, int j1, double omega) = redblack_row_scalar;
+double (*jacobi_residual_row_float)(const float *restrict urow, float *restrict trow, int ld, int j0, int j1) = jacobi_residual_row_float_scalar;
+
+/*
+ * Select the kernels for the requested instruction set
+ * (-1 => best supported by the CPU), falls back to the best supported
+ * one below the request. Returns the selected level.
+ */
+int simd_init(int level)
+{
+	int best = 0;
+
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		best = 1;
+	if (__builtin_cpu_supports("avx512f"))
+		best = 2;
+
+	if (level < 0 || level > best)
+		level = best;
+
+	switch (level)
+	{
+	case 2:
+		jacobi_row = jacobi_row_avx512;
+		jacobi_residual_row = jacobi_residual_row_avx512;
+		redblack_row = redblack_row_avx512;
+		jacobi_residual_row_float = jacobi_residual_row_float_avx512;
+		break;
+	case 1:
+		jacobi_row = jacobi_row_avx2;
+		jacobi_residual_row = jacobi_residual_row_avx2;
+		redblack_row = redblack_row_avx2;
+		jacobi_residual_row_float = jacobi_residual_row_float_avx2;
+		break;
+	default:
+		jacobi_row = jacobi_row_scalar;
+		jacobi_residual_row = jacobi_residual_row_scalar;
+		redblack_row = redblack_row_scalar;
+		jacobi_residual_row_float = jacobi_residual_row_float_scalar;
+		break;
+	}
+
+	return level;
+}
@@ -2,13 +2,33 @@
 // timing.c
 //
 
-#include <sys/time.h>
+#include <time.h>
 #include "timing.h"
 
+double phase_time[NPHASES];
+
+// monotonic, not affected by adjustments of the system clock
 double wtime()
 {
-  struct timeval tv;
-  gettimeofday(&tv, 0);
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+void phase_reset()
+{
+  int i;
+
+  for (i = 0; i < NPHASES; i++)
+    phase_time[i] = 0.0;
+}
+
+// add the time since t0 (from wtime()) to a phase, and to the trace
+void phase_add(int phase, double t0)
+{
+  const double t1 = wtime();
 
-  return tv.tv_sec + 1e-6 * tv.tv_usec;
+  phase_time[phase] += t1 - t0;
+  trace_event(phase, t0, t1);
 }
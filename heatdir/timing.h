@@ -5,6 +5,27 @@
 #ifndef TIMING_H_INCLUDED
 #define TIMING_H_INCLUDED
 
+// phases timed separately by the benchmark harness, called by the
+// master thread only; the compute sweep is the rest of the solve time
+enum
+{
+  PHASE_HALO,   // halo exchange, Gauss-Seidel pipeline, multigrid coarse grid transfer
+  PHASE_REDUCE, // global reductions of the residual and the CG dot products
+  PHASE_GATHER, // gather of the visualization
+  NPHASES
+};
+
+// event of the compute sweep in the trace, after the phases
+#define TRACE_COMPUTE NPHASES
+
+extern double phase_time[NPHASES];
+
 double wtime();
+void phase_reset();
+void phase_add(int phase, double t0);
+
+// timeline of the phases, see trace.c
+void trace_step(unsigned res, unsigned iter);
+void trace_event(int kind, double t0, double t1);
 
 #endif // TIMING_H_IINCLUDED
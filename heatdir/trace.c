@@ -0,0 +1,308 @@
+/*
+ * trace.c
+ *
+ * Timeline of the solver phases in the Chrome trace event format
+ *
+ * Every process records complete events (begin and duration) of the
+ * halo exchanges, the compute sweeps, the reductions and the gather into
+ * a ring buffer of fixed size, which keeps the latest events if a run
+ * records more. The master thread records, so no locking is needed. At
+ * the end the buffers are sent to rank 0 and written as one trace-event
+ * JSON file (chrome://tracing, ui.perfetto.dev) with one row per process.
+ *
+ * The monotonic clocks of different nodes have different origins and
+ * drift apart, so rank 0 estimates the offset of every other clock at the
+ * start and at the end of the run with ping-pong messages (the exchange
+ * with the shortest round trip, the remote time is taken as the midpoint)
+ * and maps every timestamp onto its own clock by interpolating linearly
+ * between the two offsets.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "heat.h"
+#include "timing.h"
+
+#define TRACE_PINGS 16 // ping-pong exchanges per clock offset estimate
+#define TRACE_TAG 77
+
+typedef struct
+{
+	double begin, dur; // seconds, clock of the recording process
+	unsigned iter;     // iteration of the event
+	unsigned res : 24; // resolution
+	unsigned kind : 8; // phase of timing.h or TRACE_COMPUTE
+} trace_event_t;
+
+static const char *kind_names[] = {"halo", "reduce", "gather", "compute"};
+
+static struct
+{
+	trace_event_t *ring;
+	long cap, count;   // capacity, events recorded (count > cap: wrapped)
+	unsigned res, iter;
+	double sync[2];    // local times of the two clock estimates
+	double *offset[2]; // clock of rank r minus clock of rank 0 at sync (rank 0)
+	double *remote[2]; // clock of rank r at sync (rank 0)
+} trace;
+
+/*
+ * Offset of the clock of every rank to the clock of rank 0 (collective),
+ * stored on rank 0 in trace.offset[which] and trace.remote[which]
+ */
+static void estimate_offsets(algoparam_t *param, int which)
+{
+	double t1, t2, tr, best;
+	int r, k;
+
+	MPI_Barrier(param->comm);
+	trace.sync[which] = wtime();
+
+	for (r = 1; r < param->size; r++)
+	{
+		if (param->rank == 0)
+		{
+			best = -1.0;
+			for (k = 0; k < TRACE_PINGS; k++)
+			{
+				t1 = wtime();
+				MPI_Send(&t1, 1, MPI_DOUBLE, r, TRACE_TAG, param->comm);
+				MPI_Recv(&tr, 1, MPI_DOUBLE, r, TRACE_TAG, param->comm, MPI_STATUS_IGNORE);
+				t2 = wtime();
+				if (best < 0.0 || t2 - t1 < best)
+				{
+					best = t2 - t1;
+					trace.offset[which][r] = tr - 0.5 * (t1 + t2);
+					trace.remote[which][r] = tr;
+				}
+			}
+		}
+		else if (param->rank == r)
+		{
+			for (k = 0; k < TRACE_PINGS; k++)
+			{
+				MPI_Recv(&t1, 1, MPI_DOUBLE, 0, TRACE_TAG, param->comm, MPI_STATUS_IGNORE);
+				tr = wtime();
+				MPI_Send(&tr, 1, MPI_DOUBLE, 0, TRACE_TAG, param->comm);
+			}
+		}
+	}
+
+	if (param->rank == 0)
+	{
+		trace.offset[which][0] = 0.0;
+		trace.remote[which][0] = trace.sync[which];
+	}
+}
+
+/*
+ * Allocate the ring buffer of capacity events and take the first clock
+ * offsets (collective), returns 1 on success
+ */
+int trace_init(algoparam_t *param, long capacity)
+{
+	int ok;
+
+	memset(&trace, 0, sizeof(trace));
+	trace.ring = (trace_event_t *)malloc(sizeof(trace_event_t) * capacity);
+	ok = trace.ring != 0;
+	if (param->rank == 0)
+	{
+		trace.offset[0] = (double *)malloc(sizeof(double) * 4 * param->size);
+		ok = ok && trace.offset[0];
+		if (trace.offset[0])
+		{
+			trace.offset[1] = trace.offset[0] + param->size;
+			trace.remote[0] = trace.offset[0] + 2 * param->size;
+			trace.remote[1] = trace.offset[0] + 3 * param->size;
+		}
+	}
+
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, param->comm);
+	if (!ok)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		free(trace.ring);
+		free(trace.offset[0]);
+		memset(&trace, 0, sizeof(trace));
+		return 0;
+	}
+
+	trace.cap = capacity;
+	estimate_offsets(param, 0);
+
+	return 1;
+}
+
+/*
+ * Resolution and iteration of the following events
+ */
+void trace_step(unsigned res, unsigned iter)
+{
+	trace.res = res;
+	trace.iter = iter;
+}
+
+/*
+ * Record an event from t0 to t1 (wtime()), no-op without trace_init()
+ */
+void trace_event(int kind, double t0, double t1)
+{
+	trace_event_t *e;
+
+	if (!trace.cap)
+		return;
+
+	e = &trace.ring[trace.count % trace.cap];
+	e->begin = t0;
+	e->dur = t1 - t0;
+	e->iter = trace.iter;
+	e->res = trace.res;
+	e->kind = kind;
+	trace.count++;
+}
+
+/*
+ * Local time t of rank r on the clock of rank 0
+ */
+static double to_rank0(int r, double t)
+{
+	const double s0 = trace.remote[0][r], s1 = trace.remote[1][r];
+	const double o0 = trace.offset[0][r], o1 = trace.offset[1][r];
+
+	if (s1 <= s0)
+		return t - o0;
+
+	return t - (o0 + (o1 - o0) * (t - s0) / (s1 - s0));
+}
+
+static void write_events(FILE *f, int r, const trace_event_t *ev, long n, double origin, int *first)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+	{
+		const double ts = to_rank0(r, ev[i].begin) - origin;
+
+		fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,"
+				   "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"res\":%u,\"iter\":%u}}",
+				*first ? "" : ",", kind_names[ev[i].kind],
+				ev[i].kind == TRACE_COMPUTE ? "compute" : "mpi", r,
+				1e6 * ts, 1e6 * ev[i].dur, (unsigned)ev[i].res, ev[i].iter);
+		*first = 0;
+	}
+}
+
+/*
+ * Take the second clock offsets, collect the events of all processes and
+ * write them on rank 0 (collective), returns 1 on success
+ */
+int trace_write(algoparam_t *param, const char *filename)
+{
+	trace_event_t *buf = 0;
+	long n, start, dropped, total_dropped = 0;
+	int r, coords[2], first = 1, ok = 1;
+	FILE *f = 0;
+
+	if (!trace.cap)
+		return 1;
+
+	estimate_offsets(param, 1);
+
+	// oldest event first
+	n = trace.count < trace.cap ? trace.count : trace.cap;
+	start = trace.count < trace.cap ? 0 : trace.count % trace.cap;
+	if (start > 0)
+	{
+		buf = (trace_event_t *)malloc(sizeof(trace_event_t) * n);
+		if (buf)
+		{
+			memcpy(buf, trace.ring + start, sizeof(trace_event_t) * (n - start));
+			memcpy(buf + n - start, trace.ring, sizeof(trace_event_t) * start);
+			memcpy(trace.ring, buf, sizeof(trace_event_t) * n);
+			free(buf);
+			buf = 0;
+		}
+		else
+			n = start = 0;
+	}
+	dropped = trace.count - n;
+
+	if (param->rank == 0)
+	{
+		f = fopen(filename, "w");
+		if (!f)
+		{
+			fprintf(stderr, "Error: Cannot open \"%s\" for writing\n", filename);
+			ok = 0;
+		}
+	}
+	MPI_Bcast(&ok, 1, MPI_INT, 0, param->comm);
+	if (!ok)
+		return 0;
+
+	if (param->rank == 0)
+	{
+		fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+		for (r = 0; r < param->size; r++)
+		{
+			MPI_Cart_coords(param->comm, r, 2, coords);
+			fprintf(f, "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d (%d,%d)\"}}",
+					first ? "" : ",", r, r, coords[0], coords[1]);
+			fprintf(f, ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}}", r, r);
+			first = 0;
+		}
+
+		write_events(f, 0, trace.ring, n, trace.sync[0], &first);
+		total_dropped = dropped;
+
+		for (r = 1; r < param->size; r++)
+		{
+			long m[2];
+
+			MPI_Recv(m, 2, MPI_LONG, r, TRACE_TAG, param->comm, MPI_STATUS_IGNORE);
+			total_dropped += m[1];
+			buf = (trace_event_t *)malloc(sizeof(trace_event_t) * (m[0] > 0 ? m[0] : 1));
+			if (!buf)
+				m[0] = 0;
+			MPI_Send(&m[0], 1, MPI_LONG, r, TRACE_TAG, param->comm);
+			if (m[0] > 0)
+			{
+				MPI_Recv(buf, (int)(sizeof(trace_event_t) * m[0]), MPI_BYTE, r, TRACE_TAG, param->comm, MPI_STATUS_IGNORE);
+				write_events(f, r, buf, m[0], trace.sync[0], &first);
+			}
+			free(buf);
+		}
+
+		fprintf(f, "\n],\"otherData\":{\"ranks\":%d,\"dropped_events\":%ld,\"clock\":\"CLOCK_MONOTONIC, offsets to rank 0\"}}\n",
+				param->size, total_dropped);
+		ok = !ferror(f);
+		ok = (fclose(f) == 0) && ok;
+		if (!ok)
+			fprintf(stderr, "Error: Cannot write \"%s\"\n", filename);
+		else if (total_dropped > 0)
+			fprintf(stderr, "Trace             : %ld early events overwritten, increase --trace-events\n", total_dropped);
+	}
+	else
+	{
+		long m[2] = {n, dropped};
+
+		// rank 0 answers with the number of events it can take
+		MPI_Send(m, 2, MPI_LONG, 0, TRACE_TAG, param->comm);
+		MPI_Recv(&m[0], 1, MPI_LONG, 0, TRACE_TAG, param->comm, MPI_STATUS_IGNORE);
+		if (m[0] > 0)
+			MPI_Send(trace.ring, (int)(sizeof(trace_event_t) * m[0]), MPI_BYTE, 0, TRACE_TAG, param->comm);
+	}
+
+	MPI_Bcast(&ok, 1, MPI_INT, 0, param->comm);
+	return ok;
+}
+
+void trace_free(void)
+{
+	free(trace.ring);
+	free(trace.offset[0]);
+	memset(&trace, 0, sizeof(trace));
+}
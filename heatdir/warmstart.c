@@ -0,0 +1,206 @@
+/*
+ * warmstart.c
+ *
+ * Nested iteration across the resolution sweep
+ *
+ * The solution of the previous resolution is interpolated bilinearly onto
+ * the next one and used as initial guess of the interior, the boundary
+ * values come from initialize() as usual. The grids of the arena are
+ * overwritten by initialize(), so warm_save() first copies the owned
+ * points of the old solution into a buffer. Every process needs the
+ * rectangle of old points its new block interpolates from; both
+ * partitions follow from the decomposition, so every process knows which
+ * part of its old block each other process needs, and the rectangles are
+ * redistributed with a single MPI_Alltoallw of subarray types, whichever
+ * way the partition of the rows and columns changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "heat.h"
+
+/*
+ * Old point t * (n_old - 1) / (n_new - 1) of new point t, returned as
+ * lower index i and weight w of the upper neighbor
+ */
+static void old_position(int t, int np_old, int np_new, int *i, double *w)
+{
+	const double x = (double)t * (np_old - 1) / (np_new - 1);
+
+	*i = (int)floor(x);
+	if (*i > np_old - 2)
+		*i = np_old - 2;
+	*w = x - *i;
+}
+
+/*
+ * Keep the owned points of the solution of this resolution
+ */
+int warm_save(algoparam_t *param)
+{
+	int lo_y, hi_y, lo_x, hi_x;
+
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
+
+	free(param->warm_buf);
+	param->warm_buf = (double *)malloc(sizeof(double) * (hi_y - lo_y) * (hi_x - lo_x));
+	if (!param->warm_buf)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		return 0;
+	}
+
+	copy_owned(param, param->warm_buf, 0);
+	param->warm_res = param->act_res;
+
+	return 1;
+}
+
+/*
+ * Rectangle [y0, y1) x [x0, x1) of old points the interior of the
+ * process at coords interpolates from
+ */
+static void needed_rect(algoparam_t *param, int coords[2], int *y0, int *y1, int *x0, int *x1)
+{
+	const int np_old = param->warm_res + 2;
+	const int np_new = param->act_res + 2;
+	int start_y, start_x, rows, cols;
+	double w;
+
+	decompose(param->act_res, param->dims[0], coords[0], &start_y, &rows);
+	decompose(param->act_res, param->dims[1], coords[1], &start_x, &cols);
+
+	old_position(start_y + 1, np_old, np_new, y0, &w);
+	old_position(start_y + rows, np_old, np_new, y1, &w);
+	old_position(start_x + 1, np_old, np_new, x0, &w);
+	old_position(start_x + cols, np_old, np_new, x1, &w);
+	*y1 += 2;
+	*x1 += 2;
+}
+
+/*
+ * Subarray type of the intersection of [y0, y1) x [x0, x1) and
+ * [b_y0, b_y1) x [b_x0, b_x1) within the second one, returns 0 if empty
+ */
+static int intersection_type(int y0, int y1, int x0, int x1,
+							 int b_y0, int b_y1, int b_x0, int b_x1, MPI_Datatype *type)
+{
+	int sizes[2], subsizes[2], starts[2];
+
+	starts[0] = (y0 > b_y0 ? y0 : b_y0);
+	starts[1] = (x0 > b_x0 ? x0 : b_x0);
+	subsizes[0] = (y1 < b_y1 ? y1 : b_y1) - starts[0];
+	subsizes[1] = (x1 < b_x1 ? x1 : b_x1) - starts[1];
+	if (subsizes[0] <= 0 || subsizes[1] <= 0)
+		return 0;
+
+	sizes[0] = b_y1 - b_y0;
+	sizes[1] = b_x1 - b_x0;
+	starts[0] -= b_y0;
+	starts[1] -= b_x0;
+	MPI_Type_create_subarray(2, sizes, subsizes, starts, MPI_ORDER_C, MPI_DOUBLE, type);
+	MPI_Type_commit(type);
+
+	return 1;
+}
+
+/*
+ * Interpolate the saved solution onto the interior of the initialized
+ * grids, no-op without a saved solution. The saved solution is kept for
+ * the repeated trials of the benchmark harness.
+ */
+int warm_start(algoparam_t *param)
+{
+	const int np_old = param->warm_res + 2;
+	const int np_new = param->act_res + 2;
+	const int size = param->size;
+	int lo_y, hi_y, lo_x, hi_x, y0, y1, x0, x1, i, j, r, ok;
+	int o_lo_y, o_hi_y, o_lo_x, o_hi_x, n_y0, n_y1, n_x0, n_x1, coords[2];
+	int *counts, *displs;
+	double *old = 0, *buf = 0, wy, wx;
+	MPI_Datatype *sendtypes, *recvtypes;
+
+	if (!param->warm_buf)
+		return 1;
+
+	owned_range(param, param->act_res, param->coords, &lo_y, &hi_y, &lo_x, &hi_x);
+	needed_rect(param, param->coords, &y0, &y1, &x0, &x1);
+
+	old = (double *)malloc(sizeof(double) * (y1 - y0) * (x1 - x0));
+	buf = (double *)malloc(sizeof(double) * (hi_y - lo_y) * (hi_x - lo_x));
+	counts = (int *)malloc(sizeof(int) * 3 * size);
+	sendtypes = (MPI_Datatype *)malloc(sizeof(MPI_Datatype) * 2 * size);
+	ok = old && buf && counts && sendtypes;
+	MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_MIN, param->comm);
+	if (!ok)
+	{
+		fprintf(stderr, "Error: Cannot allocate memory\n");
+		free(old);
+		free(buf);
+		free(counts);
+		free(sendtypes);
+		return 0;
+	}
+	displs = counts + 2 * size;
+	recvtypes = sendtypes + size;
+
+	// send: part of the old block needed by r, receive: part of the rectangle owned by r
+	owned_range(param, param->warm_res, param->coords, &o_lo_y, &o_hi_y, &o_lo_x, &o_hi_x);
+	for (r = 0; r < size; r++)
+	{
+		MPI_Cart_coords(param->comm, r, 2, coords);
+		displs[r] = 0;
+
+		needed_rect(param, coords, &n_y0, &n_y1, &n_x0, &n_x1);
+		counts[r] = intersection_type(n_y0, n_y1, n_x0, n_x1,
+									  o_lo_y, o_hi_y, o_lo_x, o_hi_x, &sendtypes[r]);
+		if (!counts[r])
+			sendtypes[r] = MPI_DOUBLE;
+
+		owned_range(param, param->warm_res, coords, &n_y0, &n_y1, &n_x0, &n_x1);
+		counts[size + r] = intersection_type(n_y0, n_y1, n_x0, n_x1,
+											 y0, y1, x0, x1, &recvtypes[r]);
+		if (!counts[size + r])
+			recvtypes[r] = MPI_DOUBLE;
+	}
+
+	MPI_Alltoallw(param->warm_buf, counts, displs, sendtypes,
+				  old, counts + size, displs, recvtypes, param->comm);
+
+	for (r = 0; r < 2 * size; r++)
+		if (counts[r])
+			MPI_Type_free(&sendtypes[r]);
+
+	// boundary values of initialize(), bilinear interpolation inside
+	copy_owned(param, buf, 0);
+
+#pragma omp parallel for private(j, r, wy, wx) schedule(static)
+	for (i = param->start_y + 1; i <= param->start_y + param->local_rows; i++)
+	{
+		int oy, ox;
+		double *row;
+
+		old_position(i, np_old, np_new, &oy, &wy);
+		row = old + (oy - y0) * (x1 - x0);
+
+		for (j = param->start_x + 1; j <= param->start_x + param->local_cols; j++)
+		{
+			old_position(j, np_old, np_new, &ox, &wx);
+			r = ox - x0;
+			buf[(i - lo_y) * (hi_x - lo_x) + j - lo_x] =
+				(1.0 - wy) * ((1.0 - wx) * row[r] + wx * row[r + 1]) +
+				wy * ((1.0 - wx) * row[r + (x1 - x0)] + wx * row[r + 1 + (x1 - x0)]);
+		}
+	}
+
+	copy_owned(param, buf, 1);
+
+	free(old);
+	free(buf);
+	free(counts);
+	free(sendtypes);
+
+	return 1;
+}
@@ -14,12 +14,14 @@
 
 void usage(char *s)
 {
-	fprintf(stderr, "Usage: %s <input file> [result file]\n\n", s);
+	fprintf(stderr, "Usage: %s <input file> [result file] [tile width] [time steps]\n\n", s);
+	fprintf(stderr, "  time steps > 1 advances Jacobi that many iterations per tile,\n");
+	fprintf(stderr, "  the residual is checked after every time steps iterations\n\n");
 }
 
 int main(int argc, char *argv[])
 {
-	unsigned iter;
+	unsigned iter, steps;
 	FILE *infile, *resfile;
 	char *resfilename;
 
@@ -70,6 +72,13 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
+	// optional column strip width of the Jacobi sweep
+	param.tile = (argc >= 4) ? atoi(argv[3]) : 0;
+	// optional number of iterations per temporal tile
+	param.steps = (argc >= 5) ? atoi(argv[4]) : 1;
+	if (param.steps < 1)
+		param.steps = 1;
+
 	print_params(&param);
 
 	// set the visualization resolution
@@ -78,6 +87,7 @@ int main(int argc, char *argv[])
 	param.u = 0;
 	param.uhelp = 0;
 	param.uvis = 0;
+	param.tiles = 0;
 
 	param.act_res = param.initial_res;
 
@@ -94,6 +104,7 @@ int main(int argc, char *argv[])
 			fprintf(stderr, "Error in Jacobi initialization.\n\n");
 
 			usage(argv[0]);
+			return 1;
 		}
 
 		fprintf(stderr, "Resolution: %5u\r", param.act_res);
@@ -110,7 +121,17 @@ int main(int argc, char *argv[])
 		{
 			if (0 == param.algorithm)
 			{ // JACOBI
-				residual = relax_jacobi_residual(param.u, param.uhelp, np, np);
+				if (param.steps > 1)
+				{
+					// several iterations per epoch, the last epoch stops at maxiter
+					steps = param.steps;
+					if (param.maxiter > 0 && param.maxiter - iter < steps)
+						steps = param.maxiter - iter;
+					residual = relax_jacobi_temporal(param.u, param.uhelp, np, np, param.tile, steps, param.tiles);
+					iter += steps - 1;
+				}
+				else
+					residual = relax_jacobi_residual(param.u, param.uhelp, np, np, param.tile);
 
 				// swap u and uhelp
 				double *tmp = param.u;
@@ -29,11 +29,14 @@ typedef struct
     unsigned initial_res;
     unsigned res_step_size;
     int algorithm;          // 0=>Jacobi, 1=>Gauss
+    unsigned tile;          // column strip width of the Jacobi sweep, 0=>whole rows
+    unsigned steps;         // Jacobi iterations per temporal tile, 1=>plain sweeps
 
     unsigned visres;        // visualization resolution
   
     double *u, *uhelp;
     double *uvis;
+    double *tiles;          // two tile buffers per thread of the temporally tiled sweep
 
     unsigned   numsrcs;     // number of heat sources
     heatsrc_t *heatsrcs;
@@ -58,6 +61,9 @@ void relax_gauss( double *u,
 		  unsigned sizex, unsigned sizey  );
 
 // Jacobi: relax_jacobi.c
-double relax_jacobi_residual(double * restrict u, double * restrict utmp, unsigned sizex, unsigned sizey);
+double relax_jacobi_residual(double * restrict u, double * restrict utmp, unsigned sizex, unsigned sizey, unsigned tile);
+#define TEMPORAL_TILE 128 // default tile size of the temporally tiled sweep
+#define TEMPORAL_WIDTH(tile, steps) (((tile) > 0 ? (int)(tile) : TEMPORAL_TILE) + 2 * (int)(steps)) // row length of a tile buffer
+double relax_jacobi_temporal(double * restrict u, double * restrict utmp, unsigned sizex, unsigned sizey, unsigned tile, unsigned steps, double *tiles);
 
 #endif // JACOBI_H_INCLUDED
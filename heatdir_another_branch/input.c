@@ -77,6 +77,10 @@ void print_params( algoparam_t *param )
   fprintf(stderr, "Algorithm         : %d (%s)\n",
 	  param->algorithm,
 	  (param->algorithm == 0) ? "Jacobi":"Gauss-Jacobi" );
+  if( param->tile > 0 )
+    fprintf(stderr, "Tile width        : %u\n", param->tile);
+  if( param->steps > 1 )
+    fprintf(stderr, "Temporal tiling   : %u iterations per tile\n", param->steps);
   fprintf(stderr, "Num. Heat sources : %u\n", param->numsrcs);
 
   for( i=0; i<param->numsrcs; i++ )
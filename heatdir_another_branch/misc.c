@@ -9,6 +9,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
 #include <omp.h>
@@ -37,23 +38,39 @@ int initialize( algoparam_t *param )
 				      (param->visres+2) *
 				      (param->visres+2) );
   
-	#pragma omp parallel for private(i, j)
-	for (int i = 1; i < np-1; i++)
+    if( !(param->u) || !(param->uhelp) || !(param->uvis) )
+    {
+	fprintf(stderr, "Error: Cannot allocate memory\n");
+	return 0;
+    }
+
+    // tile buffers of the temporally tiled sweep, each thread touches its own
+    if( param->steps > 1 )
+    {
+	const int w = TEMPORAL_WIDTH(param->tile, param->steps);
+
+	param->tiles = (double*)malloc( sizeof(double) * 2*w*w * omp_get_max_threads() );
+	if( !(param->tiles) )
+	{
+	    fprintf(stderr, "Error: Cannot allocate memory\n");
+	    return 0;
+	}
+
+	#pragma omp parallel
+	memset(param->tiles + 2*w*w * omp_get_thread_num(), 0, sizeof(double) * 2*w*w);
+    }
+
+    // zero both grids including the border, every thread touches
+    // the rows it updates first
+	#pragma omp parallel for private(i, j) schedule(static)
+	for (i = 0; i < np; i++)
 	{
-		for (int j = 1; i < np-1; i++)
+		for (j = 0; j < np; j++)
 		{
 			param->u[i*np+j] = 0.0;
 			param->uhelp[i*np+j] = 0.0;
 		}
-		
 	}
-	
-
-    if( !(param->u) || !(param->uhelp) || !(param->uvis) )
-    {
-	fprintf(stderr, "Error: Cannot allocate memory\n");
-	return 0;
-    }
 
     for( i=0; i<param->numsrcs; i++ )
     {
@@ -122,6 +139,10 @@ int initialize( algoparam_t *param )
 	}
     }
 
+    // copy boundary conditions to uhelp, the sweeps only write the interior
+    for( i=0; i<np*np; i++ )
+	param->uhelp[i] = param->u[i];
+
     return 1;
 }
 
@@ -145,6 +166,11 @@ int finalize( algoparam_t *param )
 	param->uvis = 0;
     }
 
+    if( param->tiles ) {
+	free(param->tiles);
+	param->tiles = 0;
+    }
+
     return 1;
 }
 
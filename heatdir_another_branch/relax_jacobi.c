@@ -7,26 +7,127 @@
 
 #include "heat.h"
 #include <omp.h>
+#include <stdlib.h>
+#include <string.h>
 
 /*
  * Combined Jacobi iteration and residual calculation
+ *
+ * With tile > 0 the grid is swept in column strips of tile points, so the
+ * three rows the stencil reads stay in L1/L2 for large resolutions. The
+ * static schedule gives every thread the same rows in all strips, the
+ * strips need no barrier in between.
  */
-double relax_jacobi_residual(double * restrict u, double * restrict uhelp, unsigned sizex, unsigned sizey) {
-    unsigned i, j;
+double relax_jacobi_residual(double * restrict u, double * restrict uhelp, unsigned sizex, unsigned sizey, unsigned tile) {
+    const unsigned tw = (tile > 0) ? tile : sizey - 2;
+    unsigned i, j, jj, jend;
     double *urow, *urow_above, *urow_below, *uhelp_row;
     double diff = 0.0;
 	double sum = 0.0;
 
-	#pragma omp parallel for private(i, j, urow, urow_above, urow_below, uhelp_row, diff) reduction(+:sum)
-    for (i = 1; i < sizex - 1; i++) {
-        urow = u + i * sizex;
-        urow_above = urow - sizex;
-        urow_below = urow + sizex;
-        uhelp_row = uhelp + i * sizex;
-        for (j = 1; j < sizey - 1; j++) {
-            uhelp_row[j] = 0.25 * (urow[j - 1] + urow[j + 1] + urow_above[j] + urow_below[j]);
-            diff = uhelp_row[j] - urow[j];
-            sum += diff * diff;
+	#pragma omp parallel private(i, j, jj, jend, urow, urow_above, urow_below, uhelp_row, diff) reduction(+:sum)
+    for (jj = 1; jj < sizey - 1; jj += tw) {
+        jend = (jj + tw < sizey - 1) ? jj + tw : sizey - 1;
+
+	#pragma omp for schedule(static) nowait
+        for (i = 1; i < sizex - 1; i++) {
+            urow = u + i * sizex;
+            urow_above = urow - sizex;
+            urow_below = urow + sizex;
+            uhelp_row = uhelp + i * sizex;
+            for (j = jj; j < jend; j++) {
+                uhelp_row[j] = 0.25 * (urow[j - 1] + urow[j + 1] + urow_above[j] + urow_below[j]);
+                diff = uhelp_row[j] - urow[j];
+                sum += diff * diff;
+            }
+        }
+    }
+
+    return sum;
+}
+
+/*
+ * Temporally tiled Jacobi: advances steps iterations per call
+ *
+ * The grid is split into tile x tile blocks that are processed
+ * independently by the threads. Each block is loaded with a margin of
+ * steps points into two private buffers and advanced steps times while
+ * it stays in cache; the region updated shrinks by one point per step
+ * (overlapped trapezoids), so the margin is recomputed redundantly
+ * instead of synchronizing with the neighbor tiles. The result of the
+ * owned points goes to uhelp, which leaves u intact for the other tiles.
+ * The buffers of all threads (tiles, two of TEMPORAL_WIDTH^2 points per
+ * thread) are allocated once in initialize().
+ *
+ * The values are identical to steps calls of relax_jacobi_residual(),
+ * the returned residual is the one of the last step.
+ */
+double relax_jacobi_temporal(double * restrict u, double * restrict uhelp, unsigned sizex, unsigned sizey, unsigned tile, unsigned steps, double *tiles)
+{
+    const int T = steps;
+    const int B = (tile > 0) ? tile : TEMPORAL_TILE;
+    const int w = TEMPORAL_WIDTH(tile, steps); // row length of the tile buffers
+    const int ntilesy = (sizex - 2 + B - 1) / B;
+    const int ntilesx = (sizey - 2 + B - 1) / B;
+    int tiley, tilex;
+    double sum = 0.0;
+
+	#pragma omp parallel reduction(+:sum)
+    {
+        double *a = tiles + 2 * w * w * omp_get_thread_num();
+        double *b = a + w * w;
+        double *src, *dst, *tmp, diff;
+        int i, j, s, r0, r1, c0, c1, y0, y1, x0, x1, lo_i, hi_i, lo_j, hi_j;
+
+	#pragma omp for collapse(2) schedule(static)
+        for (tiley = 0; tiley < ntilesy; tiley++) {
+            for (tilex = 0; tilex < ntilesx; tilex++) {
+                // owned points of the tile
+                r0 = 1 + tiley * B;
+                r1 = (r0 + B < sizex - 1) ? r0 + B : sizex - 1;
+                c0 = 1 + tilex * B;
+                c1 = (c0 + B < sizey - 1) ? c0 + B : sizey - 1;
+
+                // loaded with a margin of T points, clipped at the border
+                y0 = (r0 - T > 0) ? r0 - T : 0;
+                y1 = (r1 + T < sizex) ? r1 + T : sizex;
+                x0 = (c0 - T > 0) ? c0 - T : 0;
+                x1 = (c1 + T < sizey) ? c1 + T : sizey;
+
+                for (i = y0; i < y1; i++) {
+                    memcpy(&a[(i - y0) * w], &u[i * sizex + x0], sizeof(double) * (x1 - x0));
+                    memcpy(&b[(i - y0) * w], &u[i * sizex + x0], sizeof(double) * (x1 - x0));
+                }
+
+                src = a;
+                dst = b;
+                for (s = 1; s <= T; s++) {
+                    lo_i = (r0 - T + s > 1) ? r0 - T + s : 1;
+                    hi_i = (r1 + T - s < sizex - 1) ? r1 + T - s : sizex - 1;
+                    lo_j = (c0 - T + s > 1) ? c0 - T + s : 1;
+                    hi_j = (c1 + T - s < sizey - 1) ? c1 + T - s : sizey - 1;
+
+                    for (i = lo_i; i < hi_i; i++) {
+                        const double *srow = src + (i - y0) * w;
+                        double *drow = dst + (i - y0) * w;
+                        for (j = lo_j - x0; j < hi_j - x0; j++)
+                            drow[j] = 0.25 * (srow[j - 1] + srow[j + 1] + srow[j - w] + srow[j + w]);
+                    }
+
+                    tmp = src;
+                    src = dst;
+                    dst = tmp;
+                }
+
+                // src holds the last step, dst the one before
+                for (i = r0; i < r1; i++) {
+                    for (j = c0; j < c1; j++) {
+                        uhelp[i * sizex + j] = src[(i - y0) * w + (j - x0)];
+                        diff = src[(i - y0) * w + (j - x0)] - dst[(i - y0) * w + (j - x0)];
+                        sum += diff * diff;
+                    }
+                }
+            }
         }
     }
 